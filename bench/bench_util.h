@@ -0,0 +1,42 @@
+/**
+ * What the benchmarks and tools share: the clock they time with, the
+ * cost per operation of a timed stretch, and the shuffled keys most of
+ * them insert.
+ */
+
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <random>
+#include <vector>
+
+typedef std::chrono::steady_clock clock_type;
+
+/**
+ * Nanoseconds per operation from start until now.
+ *
+ * @param start when the timed stretch began
+ * @param ops how many operations it ran
+ */
+inline double ns_since(clock_type::time_point start, std::size_t ops) {
+	std::chrono::duration<double, std::nano> took = clock_type::now() - start;
+	return took.count() / ops;
+}
+
+/**
+ * The keys stride * i + offset for i below count, shuffled.
+ *
+ * @param rng shuffles the keys, and is left advanced for the caller's
+ *        further draws
+ */
+inline std::vector<long> shuffled_keys(std::size_t count, long stride, long offset, std::mt19937_64& rng) {
+	std::vector<long> keys(count);
+	for (std::size_t i = 0; i < count; ++i) keys[i] = stride * static_cast<long>(i) + offset;
+	std::shuffle(keys.begin(), keys.end(), rng);
+	return keys;
+}
+
+#endif
@@ -0,0 +1,59 @@
+/**
+ * Insert throughput for ordered and nearly ordered keys: plain insert(),
+ * insert(end(), elem) and std::set as a reference point.
+ *
+ *   g++ -O2 -std=c++14 -I.. btree_append_bench.cpp -o btree_append_bench
+ *   ./btree_append_bench [count] [node capacity]
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "bench_util.h"
+#include "btree.h"
+
+namespace {
+
+template <typename Insert>
+double ns_per_insert(const std::vector<long>& keys, Insert insert) {
+	clock_type::time_point start = clock_type::now();
+	for (long key : keys) insert(key);
+	return ns_since(start, keys.size());
+}
+
+void report(const char* workload, const std::vector<long>& keys, std::size_t capacity) {
+	btree<long> plain(capacity);
+	btree<long> hinted(capacity);
+	std::set<long> reference;
+	double plain_ns = ns_per_insert(keys, [&](long key) { plain.insert(key); });
+	double hinted_ns = ns_per_insert(keys, [&](long key) { hinted.insert(hinted.end(), key); });
+	double set_ns = ns_per_insert(keys, [&](long key) { reference.insert(reference.end(), key); });
+	std::cout << workload << ": insert " << plain_ns << " ns, insert(end()) " << hinted_ns
+		<< " ns, std::set hinted " << set_ns << " ns" << std::endl;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+	std::size_t capacity = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 40;
+	std::mt19937_64 rng(42);
+
+	std::vector<long> sequential(count);
+	for (std::size_t i = 0; i < count; ++i) sequential[i] = i;
+
+	// mostly increasing, with about one key in eight arriving a little late
+	std::vector<long> near(sequential);
+	for (std::size_t i = 8; i < count; i += 8) std::swap(near[i], near[i - rng() % 8]);
+
+	std::vector<long> shuffled = shuffled_keys(count, 1, 0, rng);
+
+	std::cout << count << " keys, node capacity " << capacity << std::endl;
+	report("sequential", sequential, capacity);
+	report("near-sequential", near, capacity);
+	report("random", shuffled, capacity);
+	return 0;
+}
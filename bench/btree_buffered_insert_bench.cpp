@@ -0,0 +1,43 @@
+/**
+ * Random-key ingest: insert() against insert_buffered() for a few
+ * buffer sizes.  The buffered timings include the final flush().
+ *
+ *   g++ -O2 -std=c++14 -I.. btree_buffered_insert_bench.cpp -o btree_buffered_insert_bench
+ *   ./btree_buffered_insert_bench [count] [buffer size...]
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "btree.h"
+
+int main(int argc, char* argv[]) {
+	std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4000000;
+	std::vector<std::size_t> buffers;
+	for (int i = 2; i < argc; ++i) buffers.push_back(std::strtoul(argv[i], nullptr, 10));
+	if (buffers.empty()) buffers = {16, 64, 256, 1024};
+
+	std::mt19937_64 rng(17);
+	std::vector<long> keys(count);
+	for (long& key : keys) key = rng();
+
+	btree<long> plain;
+	clock_type::time_point start = clock_type::now();
+	for (long key : keys) plain.insert(key);
+	std::cout << count << " random keys: insert " << ns_since(start, count) << " ns" << std::endl;
+
+	for (std::size_t buffer : buffers) {
+		btree<long> buffered;
+		buffered.set_insert_buffer(buffer);
+		start = clock_type::now();
+		for (long key : keys) buffered.insert_buffered(key);
+		buffered.flush();
+		double took = ns_since(start, count);
+		std::cout << "  insert_buffered, " << buffer << " per node: " << took << " ns ("
+			<< buffered.size() << " elements)" << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,80 @@
+/**
+ * Skewed lookups with and without a lookup cache: keys are drawn from a
+ * Zipfian distribution over a large btree, so a few thousand of them get
+ * most of the find() calls.  Also reports a run where every 100th
+ * operation is an insert, which shifts elements but keeps the cache.
+ *
+ *   g++ -O2 -std=c++14 -I.. btree_cache_bench.cpp -o btree_cache_bench
+ *   ./btree_cache_bench [count] [lookups] [zipf exponent]
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "btree.h"
+
+namespace {
+
+// draws ranks 0..n-1 with probability proportional to 1 / (rank + 1)^s
+std::vector<std::size_t> zipf_ranks(std::size_t n, double s, std::size_t draws, std::mt19937_64& rng) {
+	std::vector<double> cumulative(n);
+	double total = 0;
+	for (std::size_t i = 0; i < n; ++i) cumulative[i] = total += 1 / std::pow(i + 1.0, s);
+	std::uniform_real_distribution<double> uniform(0, total);
+	std::vector<std::size_t> ranks(draws);
+	for (std::size_t& rank : ranks) {
+		rank = std::lower_bound(cumulative.begin(), cumulative.end(), uniform(rng)) - cumulative.begin();
+		rank = std::min(rank, n - 1);
+	}
+	return ranks;
+}
+
+double run(btree<long>& tree, const std::vector<long>& probes, std::size_t insert_every, long& next_key) {
+	std::size_t found = 0;
+	clock_type::time_point start = clock_type::now();
+	for (std::size_t i = 0; i < probes.size(); ++i) {
+		if (insert_every != 0 && i % insert_every == 0) tree.insert(next_key += 2);
+		found += tree.find(probes[i]) != tree.end();
+	}
+	double ns = ns_since(start, probes.size());
+	if (found != probes.size()) std::cout << "(MISSING " << probes.size() - found << ")" << std::endl;
+	return ns;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+	std::size_t lookups = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4000000;
+	double exponent = argc > 3 ? std::strtod(argv[3], nullptr) : 0.99;
+	std::mt19937_64 rng(41);
+
+	std::vector<long> keys = shuffled_keys(count, 2, 0, rng);
+	btree<long> tree;
+	for (long key : keys) tree.insert(key);
+
+	// rank r is the r-th hottest key, spread at random over the key space
+	std::vector<std::size_t> ranks = zipf_ranks(count, exponent, lookups, rng);
+	std::vector<long> probes(lookups);
+	for (std::size_t i = 0; i < lookups; ++i) probes[i] = keys[ranks[i]];
+
+	std::cout << count << " keys, " << lookups << " zipf(" << exponent << ") lookups" << std::endl;
+	// the inserts append keys past the largest, so each one adds an element
+	long next_key = 2 * static_cast<long>(count);
+	for (std::size_t insert_every : {std::size_t(0), std::size_t(100)}) {
+		std::cout << (insert_every == 0 ? " lookups only:" : " one insert per 100 lookups:") << std::endl;
+		for (std::size_t entries : {std::size_t(0), std::size_t(1024), std::size_t(4096), std::size_t(16384)}) {
+			tree.set_lookup_cache(entries);
+			double ns = run(tree, probes, insert_every, next_key);
+			std::cout << "  cache " << entries << ": " << ns << " ns/op";
+			if (entries != 0) std::cout << ", hit rate " << 100.0 * tree.cache_hits() / tree.cache_lookups() << "%";
+			std::cout << std::endl;
+		}
+	}
+	return 0;
+}
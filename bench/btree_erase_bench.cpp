@@ -0,0 +1,82 @@
+/**
+ * Dropping stale keys from a large btree: erase() plus incremental
+ * compact() against rebuilding the whole btree without them, and lookup
+ * cost with the tombstones in place and after compacting them away.
+ *
+ *   g++ -O2 -std=c++14 -I.. btree_erase_bench.cpp -o btree_erase_bench
+ *   ./btree_erase_bench [count] [compact budget]
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "btree.h"
+
+namespace {
+
+double find_ns(const btree<long>& tree, const std::vector<long>& keys) {
+	btree<long>::const_iterator missing = tree.cend();
+	std::size_t found = 0;
+	clock_type::time_point start = clock_type::now();
+	for (long key : keys) found += tree.find(key) != missing;
+	double ns = ns_since(start, keys.size());
+	if (found != keys.size()) std::cout << "(MISSING " << keys.size() - found << ")" << std::endl;
+	return ns;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+	std::size_t budget = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4096;
+	std::mt19937_64 rng(39);
+	std::vector<long> keys = shuffled_keys(count, 1, 0, rng);
+	btree<long> tree;
+	for (long key : keys) tree.insert(key);
+
+	// the first half of the shuffled keys go stale
+	std::vector<long> stale(keys.begin(), keys.begin() + count / 2);
+	std::vector<long> kept(keys.begin() + count / 2, keys.end());
+
+	clock_type::time_point start = clock_type::now();
+	std::vector<long> survivors;
+	survivors.reserve(kept.size());
+	std::vector<long> doomed(stale);
+	std::sort(doomed.begin(), doomed.end());
+	for (long key : tree) {
+		if (!std::binary_search(doomed.begin(), doomed.end(), key)) survivors.push_back(key);
+	}
+	btree<long> rebuilt;
+	rebuilt.assign_sorted(survivors.begin(), survivors.end());
+	double rebuild_ms = ns_since(start, 1000000);
+
+	start = clock_type::now();
+	for (long key : stale) tree.erase(key);
+	double erase_ns = ns_since(start, stale.size());
+	std::cout << count << " keys, erasing " << stale.size() << ": erase " << erase_ns << " ns each ("
+		<< erase_ns * stale.size() / 1000000 << " ms), full rebuild " << rebuild_ms << " ms" << std::endl;
+
+	std::cout << "find with " << tree.tombstones() << " tombstones: " << find_ns(tree, kept) << " ns/op" << std::endl;
+
+	std::size_t calls = 0;
+	double longest_us = 0;
+	double total_ms = 0;
+	while (true) {
+		start = clock_type::now();
+		bool worked = tree.compact(budget);
+		double took_us = ns_since(start, 1000);
+		if (!worked) break;
+		calls++;
+		longest_us = std::max(longest_us, took_us);
+		total_ms += took_us / 1000;
+	}
+	std::cout << "compact(" << budget << "): " << calls << " calls, longest " << longest_us << " us, total "
+		<< total_ms << " ms, " << tree.tombstones() << " tombstones left" << std::endl;
+	std::cout << "find after compacting: " << find_ns(tree, kept) << " ns/op, on the full rebuild: "
+		<< find_ns(rebuilt, kept) << " ns/op" << std::endl;
+	return 0;
+}
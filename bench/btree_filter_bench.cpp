@@ -0,0 +1,52 @@
+/**
+ * Lookups that mostly miss, with and without a membership filter, for
+ * a few false-positive rates.
+ *
+ *   g++ -O2 -std=c++14 -I.. btree_filter_bench.cpp -o btree_filter_bench
+ *   ./btree_filter_bench [count] [lookups]
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "btree.h"
+
+namespace {
+
+double ns_per_lookup(const btree<long>& tree, const std::vector<long>& probes, std::size_t& hits) {
+	hits = 0;
+	clock_type::time_point start = clock_type::now();
+	for (long probe : probes) hits += tree.contains(probe);
+	return ns_since(start, probes.size());
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000000;
+	std::size_t lookups = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4000000;
+	std::mt19937_64 rng(29);
+
+	std::vector<long> keys(count);
+	for (long& key : keys) key = rng() % (1L << 40);
+	btree<long> tree;
+	for (long key : keys) tree.insert(key);
+
+	// nine probes in ten are for absent keys
+	std::vector<long> probes(lookups);
+	for (std::size_t i = 0; i < lookups; ++i) probes[i] = i % 10 == 0 ? keys[rng() % count] : rng() % (1L << 40);
+
+	std::size_t hits;
+	double plain_ns = ns_per_lookup(tree, probes, hits);
+	std::cout << tree.size() << " keys: no filter " << plain_ns << " ns (" << hits << " hits)" << std::endl;
+	for (double rate : {0.1, 0.01, 0.001}) {
+		tree.set_filter(rate);
+		double filtered_ns = ns_per_lookup(tree, probes, hits);
+		std::cout << "  filter at " << rate << ", " << tree.filter_bytes() / 1024 << " KiB: "
+			<< filtered_ns << " ns (" << hits << " hits)" << std::endl;
+	}
+	return 0;
+}
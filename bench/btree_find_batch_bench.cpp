@@ -0,0 +1,51 @@
+/**
+ * Random point lookups into a btree too large for the cache, one find()
+ * at a time against find_batch(), half of the keys missing.
+ *
+ *   g++ -O2 -std=c++14 -I.. btree_find_batch_bench.cpp -o btree_find_batch_bench
+ *   ./btree_find_batch_bench [count] [lookups]
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "btree.h"
+
+int main(int argc, char* argv[]) {
+	std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4000000;
+	std::size_t lookups = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4000000;
+	std::mt19937_64 rng(11);
+
+	std::vector<long> keys = shuffled_keys(count, 2, 0, rng);
+	btree<long> tree;
+	for (long key : keys) tree.insert(key);
+
+	std::vector<long> probes(lookups);
+	for (long& probe : probes) probe = rng() % (2 * count);
+
+	const btree<long>& lookup = tree;
+	btree<long>::const_iterator missing = lookup.cend();
+	std::vector<btree<long>::const_iterator> found;
+	found.reserve(lookups);
+
+	clock_type::time_point start = clock_type::now();
+	for (long probe : probes) found.push_back(lookup.find(probe));
+	double single_ns = ns_since(start, lookups);
+	std::size_t single_hits = std::count_if(found.begin(), found.end(),
+		[&](const btree<long>::const_iterator& pos) { return pos != missing; });
+
+	found.clear();
+	start = clock_type::now();
+	lookup.find_batch(probes.begin(), probes.end(), std::back_inserter(found));
+	double batch_ns = ns_since(start, lookups);
+	std::size_t batch_hits = std::count_if(found.begin(), found.end(),
+		[&](const btree<long>::const_iterator& pos) { return pos != missing; });
+
+	std::cout << count << " keys, " << lookups << " lookups: find " << single_ns << " ns ("
+		<< single_hits << " hits), find_batch " << batch_ns << " ns (" << batch_hits << " hits)" << std::endl;
+	return 0;
+}
@@ -0,0 +1,67 @@
+/**
+ * Snapshot and restore: writing every element as text through an
+ * ostream and reading it back with one insert per element, against
+ * save() and load().  Both go through a scratch file, which is removed
+ * afterwards; point it at the disk you care about.
+ *
+ *   g++ -O2 -std=c++14 -I.. btree_io_bench.cpp -o btree_io_bench
+ *   ./btree_io_bench [count] [scratch file]
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench_util.h"
+#include "btree.h"
+
+int main(int argc, char* argv[]) {
+	std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000000;
+	std::string path = argc > 2 ? argv[2] : "btree_io_bench.snapshot";
+	std::mt19937_64 rng(42);
+	std::vector<long> keys = shuffled_keys(count, 2, 0, rng);
+	btree<long> tree;
+	for (long key : keys) tree.insert(key);
+	std::cout << count << " elements:" << std::endl;
+
+	clock_type::time_point start = clock_type::now();
+	{
+		std::ofstream out(path);
+		for (long key : tree) out << key << ' ';
+	}
+	double text_out_ns = ns_since(start, count);
+	start = clock_type::now();
+	btree<long> from_text;
+	{
+		std::ifstream in(path);
+		long key;
+		while (in >> key) from_text.insert(key);
+	}
+	double text_in_ns = ns_since(start, count);
+	std::cout << " text: write " << text_out_ns << " ns/elem, read and insert " << text_in_ns << " ns/elem"
+		<< (from_text.size() == count ? "" : " (MISMATCH)") << std::endl;
+
+	start = clock_type::now();
+	{
+		std::ofstream out(path, std::ios::binary);
+		tree.save(out);
+	}
+	double save_ns = ns_since(start, count);
+	start = clock_type::now();
+	btree<long> loaded;
+	{
+		std::ifstream in(path, std::ios::binary);
+		loaded.load(in);
+	}
+	double load_ns = ns_since(start, count);
+	std::cout << " binary: save " << save_ns << " ns/elem, load " << load_ns << " ns/elem"
+		<< (loaded.size() == count && std::equal(tree.begin(), tree.end(), loaded.begin()) ? "" : " (MISMATCH)")
+		<< std::endl;
+	std::remove(path.c_str());
+	return 0;
+}
@@ -0,0 +1,52 @@
+/**
+ * The iterator-heavy loops: a full forward and backward walk, find()
+ * compared against end() for present and absent keys, and inserts of
+ * keys already present, each of which hands back an iterator.
+ *
+ *   g++ -O2 -std=c++14 -I.. btree_iterator_bench.cpp -o btree_iterator_bench
+ *   ./btree_iterator_bench [count]
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "btree.h"
+
+int main(int argc, char* argv[]) {
+	std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+	std::mt19937_64 rng(40);
+	std::vector<long> keys = shuffled_keys(count, 2, 0, rng);
+	btree<long> tree;
+	for (long key : keys) tree.insert(key);
+
+	long sum = 0;
+	clock_type::time_point start = clock_type::now();
+	for (long key : tree) sum += key;
+	double forward_ns = ns_since(start, count);
+	start = clock_type::now();
+	for (btree<long>::const_reverse_iterator it = tree.crbegin(); it != tree.crend(); ++it) sum -= *it;
+	double backward_ns = ns_since(start, count);
+	std::cout << count << " elements: forward walk " << forward_ns << " ns/elem, backward walk " << backward_ns
+		<< " ns/elem" << (sum == 0 ? "" : " (MISMATCH)") << std::endl;
+
+	std::size_t found = 0;
+	start = clock_type::now();
+	for (long key : keys) found += tree.find(key) != tree.end();
+	double hit_ns = ns_since(start, count);
+	start = clock_type::now();
+	for (long key : keys) found += tree.find(key + 1) != tree.end();
+	double miss_ns = ns_since(start, count);
+	std::cout << "find != end(): present " << hit_ns << " ns/op, absent " << miss_ns << " ns/op"
+		<< (found == count ? "" : " (MISMATCH)") << std::endl;
+
+	std::size_t added = 0;
+	start = clock_type::now();
+	for (long key : keys) added += tree.insert(key).second;
+	double duplicate_ns = ns_since(start, count);
+	std::cout << "insert of a present key: " << duplicate_ns << " ns/op" << (added == 0 ? "" : " (MISMATCH)")
+		<< std::endl;
+	return 0;
+}
@@ -0,0 +1,73 @@
+/**
+ * The two node ownership policies (see btree_ownership.h) side by side:
+ * shared_ptr-linked nodes against raw ones, for random inserts, finds,
+ * a forward walk, erasing half the keys and compacting, copying and
+ * destroying the tree.
+ *
+ *   g++ -O2 -std=c++14 -I.. btree_ownership_bench.cpp -o btree_ownership_bench
+ *   ./btree_ownership_bench [count] [node capacity]
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "btree.h"
+
+namespace {
+
+template <typename Ownership>
+void report(const char* name, const std::vector<long>& keys, std::size_t capacity) {
+	typedef btree<long, btree_no_summary, Ownership> tree_type;
+	std::size_t count = keys.size();
+	std::unique_ptr<tree_type> tree(new tree_type(capacity));
+
+	clock_type::time_point start = clock_type::now();
+	for (long key : keys) tree->insert(key);
+	double insert_ns = ns_since(start, count);
+
+	std::size_t hits = 0;
+	start = clock_type::now();
+	for (long key : keys) hits += tree->find(key) != tree->end();
+	double find_ns = ns_since(start, count);
+
+	long sum = 0;
+	start = clock_type::now();
+	for (long key : *tree) sum += key;
+	double walk_ns = ns_since(start, count);
+
+	start = clock_type::now();
+	std::unique_ptr<tree_type> copy(new tree_type(*tree));
+	double copy_ns = ns_since(start, count);
+
+	start = clock_type::now();
+	copy.reset();
+	double destroy_ns = ns_since(start, count);
+
+	start = clock_type::now();
+	for (std::size_t i = 0; i < count; i += 2) tree->erase(keys[i]);
+	while (tree->compact(count)) {}
+	double erase_ns = ns_since(start, count / 2);
+
+	std::cout << name << ": insert " << insert_ns << " ns, find " << find_ns << " ns, walk " << walk_ns
+		<< " ns, copy " << copy_ns << " ns, destroy " << destroy_ns << " ns, erase and compact " << erase_ns
+		<< " ns per element" << (hits == count && sum != 0 ? "" : " (MISMATCH)") << std::endl;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+	std::size_t capacity = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 40;
+	std::mt19937_64 rng(42);
+	std::vector<long> keys = shuffled_keys(count, 2, 1, rng);
+
+	std::cout << count << " keys, node capacity " << capacity << std::endl;
+	report<btree_shared_nodes>("shared nodes", keys, capacity);
+	report<btree_raw_nodes>("raw nodes", keys, capacity);
+	return 0;
+}
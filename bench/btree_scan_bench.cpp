@@ -0,0 +1,61 @@
+/**
+ * A filtered range scan over most of a large btree, as an iterator loop
+ * testing every element against scan() with the same predicate, on a
+ * tree grown by random inserts and on the same keys bulk loaded.
+ *
+ *   g++ -O2 -std=c++14 -I.. btree_scan_bench.cpp -o btree_scan_bench
+ *   ./btree_scan_bench [count]
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "btree.h"
+
+namespace {
+
+void report(const char* shape, const btree<long>& tree, long lo, long hi) {
+	auto wanted = [](long x) { return (x & 15) < 3; };
+
+	btree<long>::const_iterator missing = tree.cend();
+	long iterated = 0;
+	clock_type::time_point start = clock_type::now();
+	for (btree<long>::const_iterator it = tree.find(lo); it != missing && *it < hi; ++it) {
+		if (wanted(*it)) iterated += *it;
+	}
+	double iterator_ns = ns_since(start, hi - lo);
+
+	long scanned = 0;
+	start = clock_type::now();
+	std::size_t matched = tree.scan(lo, hi, wanted, [&](const long* first, const long* last) {
+		for (; first != last; ++first) scanned += *first;
+	});
+	double scan_ns = ns_since(start, hi - lo);
+
+	std::cout << shape << ", " << matched << " matches: iterator loop " << iterator_ns << " ns/elem, scan "
+		<< scan_ns << " ns/elem" << (iterated == scanned ? "" : " (MISMATCH)") << std::endl;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4000000;
+	std::mt19937_64 rng(37);
+	std::vector<long> keys = shuffled_keys(count, 1, 0, rng);
+	btree<long> grown;
+	for (long key : keys) grown.insert(key);
+	std::sort(keys.begin(), keys.end());
+	btree<long> packed;
+	packed.assign_sorted(keys.begin(), keys.end());
+
+	long lo = count / 10;
+	long hi = count - count / 10;
+	std::cout << hi - lo << " elements in range" << std::endl;
+	report("  random inserts", grown, lo, hi);
+	report("  bulk loaded", packed, lo, hi);
+	return 0;
+}
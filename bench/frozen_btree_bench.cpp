@@ -0,0 +1,62 @@
+/**
+ * Read-only lookups, mostly misses, against a btree, the same btree
+ * frozen, and a sorted std::vector searched with std::lower_bound.
+ *
+ *   g++ -O2 -std=c++14 -I.. frozen_btree_bench.cpp -o frozen_btree_bench
+ *   ./frozen_btree_bench [count] [lookups]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "frozen_btree.h"
+
+namespace {
+
+template <typename Contains>
+double ns_per_lookup(const std::vector<long>& probes, std::size_t& hits, Contains contains) {
+	hits = 0;
+	clock_type::time_point start = clock_type::now();
+	for (long probe : probes) hits += contains(probe);
+	return ns_since(start, probes.size());
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4000000;
+	std::size_t lookups = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4000000;
+	std::mt19937_64 rng(23);
+
+	std::vector<long> shuffled = shuffled_keys(count, 8, 0, rng);
+	std::vector<long> keys(shuffled);
+	std::sort(keys.begin(), keys.end());
+	btree<long> tree;
+	for (long key : shuffled) tree.insert(key);
+
+	clock_type::time_point start = clock_type::now();
+	frozen_btree<long> frozen = tree.freeze();
+	std::chrono::duration<double, std::milli> froze = clock_type::now() - start;
+
+	// one probe in eight hits
+	std::vector<long> probes(lookups);
+	for (long& probe : probes) probe = rng() % (8 * count);
+
+	const btree<long>& lookup = tree;
+	btree<long>::const_iterator missing = lookup.cend();
+	std::size_t tree_hits, frozen_hits, vector_hits;
+	double tree_ns = ns_per_lookup(probes, tree_hits, [&](long key) { return lookup.find(key) != missing; });
+	double frozen_ns = ns_per_lookup(probes, frozen_hits, [&](long key) { return frozen.contains(key); });
+	double vector_ns = ns_per_lookup(probes, vector_hits, [&](long key) { return std::binary_search(keys.begin(), keys.end(), key); });
+
+	std::cout << count << " keys, freeze() took " << froze.count() << " ms" << std::endl;
+	std::cout << "  btree::find " << tree_ns << " ns (" << tree_hits << " hits)" << std::endl;
+	std::cout << "  frozen_btree::contains " << frozen_ns << " ns (" << frozen_hits << " hits)" << std::endl;
+	std::cout << "  std::binary_search " << vector_ns << " ns (" << vector_hits << " hits)" << std::endl;
+	return 0;
+}
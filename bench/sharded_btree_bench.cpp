@@ -0,0 +1,60 @@
+/**
+ * Concurrent random-key inserts: a single btree behind one mutex
+ * against a sharded_btree, for 1, 2, 4... threads.
+ *
+ *   g++ -O2 -std=c++14 -pthread -I.. sharded_btree_bench.cpp -o sharded_btree_bench
+ *   ./sharded_btree_bench [count] [max threads]
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "bench_util.h"
+#include "sharded_btree.h"
+
+namespace {
+
+template <typename Insert>
+double million_per_second(const std::vector<long>& keys, unsigned threads, Insert insert) {
+	clock_type::time_point start = clock_type::now();
+	std::vector<std::thread> pool;
+	for (unsigned t = 0; t < threads; ++t) {
+		pool.emplace_back([&, t]() {
+			for (std::size_t i = t; i < keys.size(); i += threads) insert(keys[i]);
+		});
+	}
+	for (std::thread& worker : pool) worker.join();
+	return 1000 / ns_since(start, keys.size());
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000000;
+	unsigned max_threads = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : std::max(1u, std::thread::hardware_concurrency());
+	std::mt19937_64 rng(31);
+	std::vector<long> keys(count);
+	for (long& key : keys) key = rng();
+
+	std::cout << count << " random keys, " << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+	for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+		btree<long> single;
+		std::mutex single_lock;
+		double locked = million_per_second(keys, threads, [&](long key) {
+			std::lock_guard<std::mutex> guard(single_lock);
+			single.insert(key);
+		});
+
+		sharded_btree<long> sharded;
+		// split points from a 1% sample, as a loader would take them
+		sharded.partition(keys.begin(), keys.begin() + count / 100);
+		double split = million_per_second(keys, threads, [&](long key) { sharded.insert(key); });
+		std::cout << "  " << threads << " threads: btree + mutex " << locked << " M/s, sharded_btree "
+			<< split << " M/s (" << sharded.shard_count() << " shards)" << std::endl;
+	}
+	return 0;
+}
@@ -17,24 +17,82 @@
 #include <memory>
 #include <algorithm>
 #include <queue>
+#include <new>
+#include <type_traits>
 
 // we better include the iterator
 #include "btree_iterator.h"
+#include "btree_summary.h"
+#include "btree_filter.h"
+#include "btree_cache.h"
+#include "btree_io.h"
+#include "btree_trace.h"
+#include "btree_ownership.h"
 
 // we do this to avoid compiler errors about non-template friends
 // what do we do, remember? :)
-template<typename T> class btree;
+template <typename T, typename Monoid, typename Ownership> class btree;
+template <typename T> class frozen_btree;
 
-template <typename T> 
-class btree {
+/**
+ * How many elements a btree keeps inside the btree object itself before
+ * it allocates its first node.  The default spends 64 bytes on it, so a
+ * btree<int> holds 16 elements without touching the heap.  Specialise
+ * this for T to pick another size; 0 turns the inline buffer off.
+ */
+template <typename T>
+struct btree_inline_capacity {
+	static const std::size_t value = 64 / sizeof(T);
+};
+
+// the inline buffer's storage, a base of btree so that with no capacity
+// it takes no room at all
+template <typename T, std::size_t Capacity>
+class btree_inline_storage {
+ protected:
+	T* inline_data() const { return reinterpret_cast<T*>(inline_elements); }
+
+ private:
+	mutable typename std::aligned_storage<sizeof(T), alignof(T)>::type inline_elements[Capacity];
+};
+
+template <typename T>
+class btree_inline_storage<T, 0> {
+ protected:
+	T* inline_data() const { return nullptr; }
+};
+
+/**
+ * How many bytes a node's element and child slot arrays take together
+ * when the btree is constructed without an explicit capacity.  Specialise
+ * this for T (512, 4096, a page...) to retune every btree<T>;
+ * tools/btree_capacity_sweep measures the candidates for a workload.
+ */
+template <typename T>
+struct btree_node_bytes {
+	static const std::size_t value = 1024;
+};
+
+// a hint that addr is about to be read; a no-op for compilers without one
+inline void btree_prefetch(const void* addr) {
+#if defined(__GNUC__)
+	__builtin_prefetch(addr);
+#else
+	(void) addr;
+#endif
+}
+
+template <typename T, typename Monoid, typename Ownership> 
+class btree : private btree_inline_storage<T, btree_inline_capacity<T>::value> {
  public:
   /** Hmm, need some iterator typedefs here... friends? **/
- 	friend class btree_iterator<T>;
-    friend class const_btree_iterator<T>;
- 	typedef btree_iterator<T> iterator;
-    typedef const_btree_iterator<T> const_iterator;
+ 	friend class btree_iterator<T, Monoid, Ownership>;
+    friend class const_btree_iterator<T, Monoid, Ownership>;
+ 	typedef btree_iterator<T, Monoid, Ownership> iterator;
+    typedef const_btree_iterator<T, Monoid, Ownership> const_iterator;
     typedef std::reverse_iterator<iterator> reverse_iterator;
     typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+    typedef typename Monoid::value_type summary_type;
 
   /**
    * Constructs an empty btree.  Note that
@@ -46,9 +104,35 @@ class btree {
    * behalf of all built-ins: ints, doubles, strings, etc.)
    * 
    * @param maxNodeElems the maximum number of elements
-   *        that can be stored in each B-Tree node
+   *        that can be stored in each B-Tree node; by default as many
+   *        as fit in btree_node_bytes<T>::value bytes
+   * @param monoid the summary policy kept up to date in every node,
+   *        see btree_summary.h
+   */
+  btree(std::size_t maxNodeElems = capacity_for(btree_node_bytes<T>::value), const Monoid& monoid = Monoid());
+
+  /**
+   * Returns the node capacity whose elements, together with the child
+   * slot beside each of them and the one extra slot, fill about
+   * node_bytes bytes, but never less than three elements a node.
+   *
+   * @param node_bytes the targeted size of a node's arrays in bytes
    */
-  btree(std::size_t maxNodeElems = 40);
+  static std::size_t capacity_for(std::size_t node_bytes) {
+      std::size_t slot = sizeof(node_ptr);
+      std::size_t fits = node_bytes > slot ? (node_bytes - slot) / (sizeof(T) + slot) : 0;
+      return std::max<std::size_t>(3, fits);
+  }
+
+  /**
+   * The bytes of a node's element and child slot arrays at a capacity,
+   * the inverse of capacity_for.
+   *
+   * @param capacity the node capacity
+   */
+  static std::size_t node_bytes_for(std::size_t capacity) {
+      return capacity * sizeof(T) + (capacity + 1) * sizeof(node_ptr);
+  }
 
   /**
    * The copy constructor and  assignment operator.
@@ -65,7 +149,7 @@ class btree {
    *
    * @param original a const lvalue reference to a B-Tree object
    */
-  btree(const btree<T>& original);
+  btree(const btree<T, Monoid, Ownership>& original);
 
   /** 
    * Move constructor
@@ -73,7 +157,7 @@ class btree {
    *
    * @param original an rvalue reference to a B-Tree object
    */
-  btree(btree<T>&& original);
+  btree(btree<T, Monoid, Ownership>&& original);
   
   
   /** 
@@ -82,7 +166,7 @@ class btree {
    *
    * @param rhs a const lvalue reference to a B-Tree object
    */
-  btree<T>& operator=(const btree<T>& rhs);
+  btree<T, Monoid, Ownership>& operator=(const btree<T, Monoid, Ownership>& rhs);
 
   /** 
    * Move assignment
@@ -91,7 +175,7 @@ class btree {
    *
    * @param rhs a const reference to a B-Tree object
    */
-  btree<T>& operator=(btree<T>&& rhs);
+  btree<T, Monoid, Ownership>& operator=(btree<T, Monoid, Ownership>&& rhs);
 
   /**
    * Puts a breadth-first traversal of the B-Tree onto the output
@@ -103,9 +187,8 @@ class btree {
    * @return a reference to os
    */
 
-  /*
-  friend std::ostream& operator<< <T> (std::ostream& os, const btree<T>& tree);
-  */
+  template <typename U, typename M, typename O>
+  friend std::ostream& operator<<(std::ostream& os, const btree<U, M, O>& tree);
 
 
   /**
@@ -121,20 +204,28 @@ class btree {
    */
 
     iterator begin() const;
-    iterator end() const{ return iterator{std::make_shared<Node>(), 0, this}; }
+    iterator end() const{ return iterator{nullptr, end_index, this}; }
     const_iterator cbegin() const;
-    const_iterator cend() const{ return const_iterator{std::make_shared<Node>(), 0, this}; };
-    reverse_iterator rbegin() const {
-        search_count = 0;
-        return reverse_iterator{iterator{tail.lock(), tail.lock()->element.size(), this}}; 
-    };
-    reverse_iterator rend() const { return reverse_iterator{begin()}; };
-    const_reverse_iterator crbegin() const {
-        search_count = 0; 
-        return const_reverse_iterator{const_iterator{tail.lock(), tail.lock()->element.size(), this}}; 
-    };
-    const_reverse_iterator crend() const { return const_reverse_iterator{cbegin()}; };
-  
+    const_iterator cend() const{ return const_iterator{nullptr, end_index, this}; };
+    reverse_iterator rbegin() const { record(btree_op::reverse_iterate, nullptr); return reverse_iterator{end()}; };
+    reverse_iterator rend() const { return reverse_iterator{leftmost()}; };
+    const_reverse_iterator crbegin() const { record(btree_op::reverse_iterate, nullptr); return const_reverse_iterator{cend()}; };
+    const_reverse_iterator crend() const { return const_reverse_iterator{const_iterator(leftmost())}; };
+
+  /**
+    * Returns the number of elements stored in the btree.  Constant
+    * time, unless buffered inserts are pending, which it settles first
+    * (see set_insert_buffer).
+    */
+  std::size_t size() const { settle(); return btree_size; }
+  bool empty() const { return btree_size == 0 && buffered == 0; }
+
+  /**
+    * Disposes of every element, leaving an empty btree with the same
+    * node capacity.
+    */
+  void clear();
+
   /**
     * Returns an iterator to the matching element, or whatever 
     * the non-const end() returns if the element could 
@@ -144,7 +235,7 @@ class btree {
     *        if an instance of a true class, relies on the operator< and
     *        and operator== methods to compare elem to elements already 
     *        in the btree.  You must ensure that your class implements
-    *        these things, else code making use of btree<T>::find will
+    *        these things, else code making use of btree<T, Monoid, Ownership>::find will
     *        not compile.
     * @return an iterator to the matching element, or whatever the
     *         non-const end() returns if no such match was ever found.
@@ -162,6 +253,24 @@ class btree {
     */
   const_iterator find(const T& elem) const;
       
+  /**
+    * Looks up every key in [first, last) and writes one const_iterator
+    * per key to out, in the same order, exactly as find would.  The
+    * lookups advance in groups of find_batch_width, one step each per
+    * round: a step either prefetches the next thing a lookup will read
+    * or consumes what an earlier round prefetched, so the cache misses
+    * of the whole group are in flight together instead of one after
+    * another.  Worth it for many independent lookups into a btree too
+    * large for the cache.
+    *
+    * @param first the start of the keys to look up.
+    * @param last one past the end of the keys to look up.
+    * @param out where the results are written.
+    * @return out advanced past the last result.
+    */
+  template <typename ForwardIt, typename OutputIt>
+  OutputIt find_batch(ForwardIt first, ForwardIt last, OutputIt out) const;
+
   /**
     * Operation which inserts the specified element
     * into the btree if a matching element isn't already
@@ -180,7 +289,7 @@ class btree {
     *
     * The insert method makes use of T's copy constructor,
     * and if these things aren't available, 
-    * then the call to btree<T>::insert will not compile.  The implementation
+    * then the call to btree<T, Monoid, Ownership>::insert will not compile.  The implementation
     * also makes use of the class's operator== and operator< as well.
     *
     * @param elem the element to be inserted.
@@ -191,31 +300,340 @@ class btree {
     */
   std::pair<iterator, bool> insert(const T& elem);
 
+  /**
+    * Inserts elem using hint as a guess of where it goes: if elem belongs
+    * immediately before hint, it is placed there without searching down
+    * from the root.  Passing end() as the hint is the append fast path,
+    * which goes straight to the node holding the largest element.  A
+    * wrong hint costs two comparisons and falls back to insert(elem).
+    * (insert(elem) itself already takes the append path when elem is
+    * larger than everything in the btree.)
+    *
+    * @param hint the position elem is expected to precede.
+    * @param elem the element to be inserted.
+    * @return an iterator positioned at elem in the btree, whether it was
+    *         inserted or already present.
+    */
+  iterator insert(const const_iterator& hint, const T& elem);
+
+  /**
+    * Removes elem, if present.  Erasing only marks the element's slot as
+    * a tombstone and updates the counts on the path above it, so it
+    * costs about as much as a find; the slot itself is reclaimed later by
+    * compact().  Iterators stay valid across an erase (except those at
+    * the erased element), and a later insert of elem reuses its slot.
+    *
+    * @param elem the element to remove.
+    * @return the number of elements removed, 0 or 1.
+    */
+  std::size_t erase(const T& elem);
+
+  /**
+    * Removes the element pos refers to, which must be dereferenceable.
+    *
+    * @param pos the position of the element to remove.
+    * @return an iterator to the element that followed it, or end().
+    */
+  iterator erase(const const_iterator& pos);
+
+  /**
+    * Tidies the btree a bounded amount at a time, for long-lived btrees
+    * that see many erases.  Tombstones are reclaimed first, by rebuilding
+    * the smallest subtrees around them that fit the budget (or, above
+    * subtrees too large for it, by unlinking them one at a time), and
+    * then subtrees holding many more nodes than a bulk load of their
+    * elements would (random inserts leave most nodes mostly empty) are
+    * rebuilt packed, loosest first.  Call it from wherever spare time is,
+    * until it returns false.  Iterators are invalidated.
+    *
+    * @param budget about how many elements, live or erased, the call may
+    *        visit and move.
+    * @return whether anything was done; false once there is nothing left
+    *         to reclaim within a budget this size.
+    */
+  bool compact(std::size_t budget);
+
+  /**
+    * Returns the number of erased elements whose slots compact() has not
+    * reclaimed yet.
+    */
+  std::size_t tombstones() const { return btree_dead; }
+
+  /**
+    * The write-optimised mode.  After set_insert_buffer(n) with n > 0,
+    * every node can hold up to n pending inserts for its subtree, and
+    * insert_buffered() only adds elem to the root's buffer.  A full
+    * buffer is handed down a level in one sorted pass, and only inserts
+    * reaching an empty child slot touch the nodes themselves, so random
+    * inserts are applied in batches that share their paths.
+    *
+    * contains() looks through the buffers on its way down and settles
+    * nothing, and neither does find() of an absent elem; find() settles
+    * every pending insert before it returns an iterator to elem, which
+    * may be stepped onto any of them.  Anything else that needs exact
+    * contents (size(), iteration, rank, aggregate, ordinary insert...)
+    * settles first, which visits every node, so interleave it with
+    * buffered inserts sparingly; in particular size() is only O(1) while
+    * nothing is pending.  Iterators taken before a buffered insert do not
+    * see it until the next settle, and settling may rebuild the nodes
+    * they point into, so take them afresh after it.
+    *
+    * Settling changes the nodes even when a const member does it, so
+    * while inserts are pending, const calls on the same btree must not
+    * run concurrently either.  flush() (or set_insert_buffer(0)) before
+    * sharing the btree between readers.
+    *
+    * @param messages how many pending inserts each node buffers; 0 settles
+    *        them all and goes back to inserting straight into the nodes.
+    */
+  void set_insert_buffer(std::size_t messages);
+  void insert_buffered(const T& elem);
+
+  /**
+    * Returns whether elem is present, counting inserts still pending in
+    * the buffers, without settling any of them.
+    */
+  bool contains(const T& elem) const;
+
+  /**
+    * Applies every pending buffered insert.
+    */
+  void flush();
+
+  /**
+    * Keeps an approximate membership filter (see btree_filter.h) beside
+    * the nodes.  find(), contains() and find_batch() ask it first, so
+    * most lookups of absent elements return without touching a node.
+    * Every insert that adds an element adds it to the filter; bulk loads
+    * rebuild it, and so does an insert that finds it full, sized for
+    * twice the elements then present.  Needs a btree_hash<T>; without
+    * one this does nothing.
+    *
+    * @param false_positive_rate the fraction of absent elements that
+    *        still get searched for; 0 drops the filter.
+    * @param expected_elements how many elements to size the filter for;
+    *        by default (and at least) the current size, but no less than
+    *        1024.
+    */
+  void set_filter(double false_positive_rate, std::size_t expected_elements = 0);
+  std::size_t filter_bytes() const { return extra != nullptr ? extra->filter.bytes() : 0; }
+
+  /**
+    * Keeps a cache of where recently found elements live (see
+    * btree_cache.h), so that find() and contains() of hot elements skip
+    * the descent from the root.  A remembered position is checked against
+    * the element found there, so inserts that only shift elements within
+    * their nodes keep the rest of the cache; anything that frees or
+    * detaches nodes (rebuilds, compaction, bulk loads, split and join)
+    * bumps a version that invalidates all of it at once.  It pays off
+    * for lookup-heavy, skewed workloads.  Lookups record into the cache, so
+    * with one in place even const lookups must not run concurrently on
+    * the same btree.  Needs a btree_hash<T>; without one this does
+    * nothing.
+    *
+    * @param entries how many elements to remember, rounded up to a power
+    *        of two; 0 drops the cache.
+    */
+  void set_lookup_cache(std::size_t entries) { if (entries != 0 || extra != nullptr) features().cache.reset(entries); }
+  std::size_t cache_hits() const { return extra != nullptr ? extra->cache.hits() : 0; }
+  std::size_t cache_lookups() const { return extra != nullptr ? extra->cache.lookups() : 0; }
+
+  /**
+    * Logs every insert, find, contains and erase, and the start of every
+    * walk (begin(), cbegin(), rbegin(), crbegin()), to recorder, which
+    * must stay alive until it is detached again (see btree_trace.h and
+    * tools/btree_replay).  A walk is logged with its direction but not
+    * its length.  Only the calls made on this btree are logged: the
+    * recorder is not copied or moved along with it, and the walks that
+    * freeze() and the set algebra make themselves are not logged.  As
+    * with the lookup cache, const calls must not run concurrently while
+    * one is attached.
+    *
+    * @param recorder_arg the recorder to log to; null stops recording.
+    */
+  void set_recorder(btree_recorder<T>* recorder_arg) { if (recorder_arg != nullptr || extra != nullptr) features().recorder = recorder_arg; }
+
+  /**
+    * Order statistics.  Every node records how many elements live in
+    * the subtree hanging off it, so the following walk a single
+    * root-to-node path instead of stepping an iterator k times.
+    */
+
+  /**
+    * Returns an iterator to the k-th smallest element (counting from 0),
+    * or end() if the btree holds k or fewer elements.
+    *
+    * @param k the zero-based rank of the element wanted.
+    */
+  iterator select(std::size_t k) const;
+
+  /**
+    * Returns the number of elements in the btree that are strictly
+    * less than elem.  elem need not be present in the btree.
+    *
+    * @param elem the client element to rank.
+    */
+  std::size_t rank(const T& elem) const;
+
+  /**
+    * Returns the zero-based position of the element an iterator refers
+    * to, or size() for the end iterator.
+    */
+  std::size_t index_of(const const_iterator& pos) const;
+
+  /**
+    * Returns the number of increments needed to get from first to last,
+    * in time proportional to the height of the btree.  Iterator
+    * subtraction (last - first) and an unqualified distance(first, last)
+    * (see btree_iterator.h) are forwarded here.  The iterators are only
+    * bidirectional, so std::distance, called qualified as the standard
+    * algorithms do, still steps through every element in between.
+    */
+  std::ptrdiff_t distance(const const_iterator& first, const const_iterator& last) const {
+      return static_cast<std::ptrdiff_t>(index_of(last)) - static_cast<std::ptrdiff_t>(index_of(first));
+  }
+
+  /**
+    * Folds the monoid over every element x with lo <= x < hi, in
+    * ascending order.  Subtrees lying wholly inside the range contribute
+    * their stored summary, so only the paths to lo and hi are walked.
+    *
+    * @param lo the inclusive lower bound of the range.
+    * @param hi the exclusive upper bound of the range.
+    * @return the combined summary, or the monoid's identity if the
+    *         range holds no elements.
+    */
+  summary_type aggregate(const T& lo, const T& hi) const;
+
+  /**
+    * Returns the summary of the whole btree.
+    */
+  summary_type summary() const;
+
+  /**
+    * Hands every element x with lo <= x < hi for which predicate(x)
+    * holds to sink, in ascending order and in batches: sink is called
+    * as sink(const T* first, const T* last) with up to scan_batch
+    * elements at a time.  The walk goes node by node rather than through
+    * iterators, and the predicate runs over each node's elements as a
+    * block, so keep it a simple, side-effect-free test; for arithmetic T
+    * and comparisons the compiler can then vectorise it.
+    *
+    * @param lo the inclusive lower bound of the range.
+    * @param hi the exclusive upper bound of the range.
+    * @param predicate called as predicate(const T&), returning bool.
+    * @param sink receives the matches, see above.
+    * @return the number of matches.
+    */
+  template <typename Predicate, typename Sink>
+  std::size_t scan(const T& lo, const T& hi, Predicate predicate, Sink sink) const;
+
+  static const std::size_t scan_batch = 256;
+
+  /**
+    * Replaces the contents of the btree with the elements in [first, last),
+    * which must already be strictly increasing.  The nodes are built
+    * bottom-up in a single pass, which is linear rather than the
+    * n log n of inserting one element at a time.
+    *
+    * @param first the start of the sorted input range.
+    * @param last one past the end of the sorted input range.
+    */
+  template <typename InputIt>
+  void assign_sorted(InputIt first, InputIt last);
+
+  /**
+    * Writes a binary snapshot of the btree to os: a header, then every
+    * element in ascending order, encoded by btree_io<T> (see btree_io.h)
+    * in blocks of save_block elements.  Only the elements are saved,
+    * not the node layout, capacity or any filter or cache settings.
+    *
+    * @param os the stream to write to, opened in binary mode.
+    * @return whether os is still good afterwards.
+    */
+  bool save(std::ostream& os) const;
+
+  /**
+    * Replaces the contents of the btree with a snapshot written by save(),
+    * building the nodes bottom-up as assign_sorted() does.  If the stream
+    * does not hold a whole snapshot of the same element type, in strictly
+    * increasing order, failbit is set and the btree is left unchanged.
+    *
+    * @param is the stream to read from, opened in binary mode.
+    * @return whether the snapshot was loaded.
+    */
+  bool load(std::istream& is);
+
+  static const std::size_t save_block = (1 << 20) / sizeof(T) > 0 ? (1 << 20) / sizeof(T) : 1;
+
+  /**
+    * Adds every element of other that is not already present, by a
+    * single ordered scan of both btrees followed by a bulk build.
+    *
+    * @param other the btree whose elements are merged in.
+    */
+  void merge(const btree<T, Monoid, Ownership>& other);
+
+  /**
+    * Moves every element that is not less than key into a new btree,
+    * which is returned; the elements less than key stay behind.  Only
+    * the nodes on the path to key are cut in two; every subtree off that
+    * path is handed over as it is.
+    *
+    * @param key the first element that belongs to the returned btree.
+    * @return a btree holding the elements >= key.
+    */
+  btree<T, Monoid, Ownership> split(const T& key);
+
+  /**
+    * Concatenates two btrees, every element of left being less than
+    * every element of right, by hanging both under a common node.
+    * If the ranges overlap it falls back to set_union.
+    *
+    * @param left the btree holding the smaller elements.
+    * @param right the btree holding the larger elements.
+    * @return a btree holding the elements of both.
+    */
+  static btree<T, Monoid, Ownership> join(btree<T, Monoid, Ownership> left, btree<T, Monoid, Ownership> right);
+
+  /**
+    * Copies the elements, in linear time, into a read-only frozen_btree
+    * laid out for searching (see frozen_btree.h, which must be included
+    * to call this).  The btree itself is left untouched.
+    */
+  frozen_btree<T> freeze() const;
+
   /**
     * Disposes of all internal resources, which includes
     * the disposal of any client objects previously
     * inserted using the insert operation. 
     * Check that your implementation does not leak memory!
     */
-  ~btree() { root.reset(); };
+  ~btree() { clear(); };
 
-  //size_t get_max_elem() { return maxNodeElems; }
+  std::size_t get_max_elem() const { return max_element; }
+  const Monoid& get_monoid() const { return monoid; }
   //Node* get_root_node() { return root; }
   
 private:
   // The details of your implementation go here
+	struct Node;
+	// how nodes hold their children and know their parent, see btree_ownership.h
+	typedef typename Ownership::template owner<Node> node_ptr;
+	typedef typename Ownership::template observer<Node> node_ref;
+
 	struct Node {
-		Node(const T& elem, std::size_t cap = 40, std::shared_ptr<Node> parent_arg = nullptr): 
+		Node(const T& elem, std::size_t cap, node_ptr parent_arg = nullptr): 
 			parent{parent_arg}, 
 			capacity{cap} { 
-                for (size_t count = 0; count < capacity + 1; ++count) children.push_back(nullptr);
+                children.resize(capacity + 1);
                 element.push_back(elem); 
             };
 
-		Node(std::size_t cap = 40, std::shared_ptr<Node> parent_arg = nullptr):
+		Node(std::size_t cap, node_ptr parent_arg = nullptr):
 			parent{parent_arg},
 			capacity{cap} {
-                for (size_t count = 0; count < capacity + 1; ++count) children.push_back(nullptr);
+                children.resize(capacity + 1);
             };
 
 		~Node() {
@@ -227,210 +645,1956 @@ private:
 		bool full() { return element.size() == capacity; };
 
 		std::vector<T> element;
-	    std::weak_ptr<Node> parent;
-		std::vector<std::shared_ptr<Node>> children;
+	    node_ref parent;
+		std::vector<node_ptr> children;
 		//size_t size;
 		std::size_t capacity;
-        std::size_t traverse_index = 0;
+        // number of elements held by this node and all of its descendants
+        std::size_t subtree_size = 0;
+        // the monoid folded over the same elements, in order
+        summary_type summary;
+        // sorted inserts pending for this subtree, in write-optimised mode;
+        // some may already be present further down
+        std::vector<T> buffer;
+        // one flag per element, set where it has been erased; empty while
+        // none of them is
+        std::vector<unsigned char> dead;
+        // erased elements, and nodes, in this subtree (including this one)
+        std::size_t subtree_dead = 0;
+        std::size_t subtree_nodes = 1;
+
+        bool alive(std::size_t index) const { return dead.empty() || !dead[index]; }
+        // the number of live elements among the first count
+        std::size_t alive_before(std::size_t count) const {
+            if (dead.empty()) return count;
+            return count - std::count(dead.begin(), dead.begin() + count, 1);
+        }
+        // keep dead in step with an element added at, or removed from, index
+        void mark_added(std::size_t index, bool erased) {
+            if (dead.empty() && !erased) return;
+            if (dead.empty()) dead.assign(element.size() - 1, 0);
+            dead.insert(dead.begin() + index, erased ? 1 : 0);
+        }
+        void mark_removed(std::size_t index) {
+            if (!dead.empty()) dead.erase(dead.begin() + index);
+        }
+
+        // the slot of children that points at child
+        std::size_t child_slot(const Node* child) const {
+            std::size_t slot = 0;
+            while (children[slot].get() != child) ++slot;
+            return slot;
+        }
 	};
 
-	std::shared_ptr<Node> root;
-	std::weak_ptr<Node> tail;
+    static std::size_t count_of(const node_ptr& node) { return node ? node->subtree_size : 0; }
+    static std::size_t dead_of(const node_ptr& node) { return node ? node->subtree_dead : 0; }
+    static std::size_t nodes_of(const node_ptr& node) { return node ? node->subtree_nodes : 0; }
+    summary_type summary_of(const node_ptr& node) const { return node ? node->summary : monoid.identity(); }
+
+    // recomputes node's summary from its elements and its children's summaries
+    void refresh_summary(Node& node) const;
+    // recomputes node's subtree counts and summary from its own elements and children
+    void recount(Node& node) const;
+    // installs new_root and resets size and tail after nodes have been cut or spliced
+    void adopt(node_ptr new_root);
+    void reset_tail();
+    node_ptr build_sorted(const T* first, std::size_t count, const node_ptr& parent) const;
+    std::pair<node_ptr, node_ptr> split_node(const node_ptr& node, const T& key) const;
+    T pop_max();
+    summary_type aggregate_from(const node_ptr& node, const T* lo, const T* hi) const;
+
+    // scan() over node's subtree, with the same null-means-open bounds
+    template <typename Predicate, typename Sink>
+    std::size_t scan_node(const node_ptr& node, const T* lo, const T* hi,
+        Predicate& predicate, Sink& sink, std::vector<T>& batch) const;
+    // filters the consecutive elements [first, last) into batch, skipping
+    // those flagged in dead unless it is null
+    template <typename Predicate, typename Sink>
+    std::size_t scan_run(const T* first, const T* last, const unsigned char* dead,
+        Predicate& predicate, Sink& sink, std::vector<T>& batch) const;
+    // appends the elements of in whose keep flag is set to batch, without
+    // branching on the flags where T allows it
+    static void compact(const T* in, const unsigned char* keep, std::size_t count, std::vector<T>& batch, std::true_type);
+    static void compact(const T* in, const unsigned char* keep, std::size_t count, std::vector<T>& batch, std::false_type);
+    static const std::size_t scan_chunk = 64;
+
+    // stores elem at index of cur, whose child slot there must be empty, and
+    // updates everything above it; the common tail of every insert path
+    iterator place(node_ptr cur, std::size_t index, const T& elem);
+    // place() short of the rebuild: leaves cur and index at elem and returns
+    // the subtree that is now too tall, if any, for the caller to rebuild
+    node_ptr store(node_ptr& cur, std::size_t& index, const T& elem);
+    // places elem, which is larger than every element, after the tail
+    iterator append(const T& elem);
+    // insert(hint, elem) once any pending inserts have settled
+    iterator insert_near(const const_iterator& hint, const T& elem);
+    // appends the elements of node's subtree to out, in order
+    void flatten(const node_ptr& node, std::vector<T>& out) const;
+    // save() over node's subtree, and over the elements [first, last) of
+    // node; block fills up to save_block elements between writes
+    void save_node(const node_ptr& node, std::vector<T>& block, std::ostream& os) const;
+    void save_run(const Node& node, std::size_t first, std::size_t last, std::vector<T>& block, std::ostream& os) const;
+    void rebuild(const node_ptr& node);
+
+    template <typename... Args>
+    static node_ptr make_node(Args&&... args) { return Ownership::template make<Node>(std::forward<Args>(args)...); }
+    // once no slot refers to node any more: free_node frees it alone (its
+    // children having moved elsewhere), free_subtree along with everything
+    // below it.  Only raw nodes need it; shared ones go with their last owner.
+    static void free_node(const node_ptr& node) { Ownership::release(node); }
+    static void free_subtree(const node_ptr& node);
+
+    // erase() and compact(): kill marks the element at index of node as
+    // erased and revive undoes that; unlink physically removes a
+    // tombstone; prune detaches node, and then each ancestor, while it is
+    // left with neither elements nor children, moving their buffers to
+    // messages, and returns the first node it keeps
+    void kill(const node_ptr& node, std::size_t index);
+    void revive(const node_ptr& node, std::size_t index);
+    void unlink(const node_ptr& node, std::size_t index);
+    node_ptr prune(node_ptr node, std::vector<T>& messages);
+    // drops a pending insert of elem from node's buffer
+    bool unbuffer(Node& node, const T& elem);
+    // the two halves of compact(), each spending from budget
+    void reclaim(std::size_t& budget);
+    void tighten(std::size_t& budget);
+    // merges the child in slot of node, which must have room for its
+    // elements, into node
+    void fold(const node_ptr& node, std::size_t slot);
+    // the number of nodes build_sorted makes for count elements
+    std::size_t packed_nodes(std::size_t count) const;
+
+    // the buffered-insert machinery, see set_insert_buffer; settle() is
+    // logically const, as the contents do not change, only where they live
+    void settle() const { if (buffered != 0) const_cast<btree<T, Monoid, Ownership>*>(this)->flush(); }
+    std::pair<iterator, bool> insert_now(const T& elem);
+    // messages [first, last) of ready, all bound for the empty child slot
+    // of node
+    struct landing {
+        node_ptr node;
+        std::size_t slot;
+        std::size_t first, last;
+    };
+    // hands node's buffer to its children's buffers, or to ready where a
+    // slot has no child, and spills on into any child that overflows (or,
+    // when all is set, into every child)
+    void spill(const node_ptr& node, std::vector<T>& ready, std::vector<landing>& landings, bool all);
+    // inserts what spill() made ready, each message straight into its slot
+    void apply(const std::vector<T>& ready, const std::vector<landing>& landings);
+    // inserts messages from wherever they were, each from the root
+    void apply(const std::vector<T>& messages);
+    // merges the sorted, distinct messages [first, last) into node's buffer
+    void absorb(Node& node, const T* first, const T* last);
+    // as absorb, for messages gathered in any order from node's range
+    void rehome(Node& node, std::vector<T>& messages);
+    // moves the messages of node that are not less than bound to out
+    void cut_buffer(Node& node, const T& bound, std::vector<T>& out);
+    void gather_buffers(const node_ptr& node, std::vector<T>& out);
+
+    // bumps shape_version, for anything that frees or detaches nodes;
+    // elements that merely move within or between live nodes are caught
+    // by cached() checking the element it finds
+    void reshaped() { if (extra != nullptr) extra->shape_version++; }
+    // the cache side of find() and contains(): a remembered position of elem
+    // that is still current, or a null node
+    Node* cached(const T& elem, std::size_t& index) const;
+    void remember(const T& elem, Node* node, std::size_t index) const {
+        if (extra != nullptr) extra->cache.remember(elem, extra->shape_version, std::make_pair(node, index));
+    }
+    // the filter side: false only if elem is certainly absent
+    bool may_contain(const T& elem) const { return extra == nullptr || extra->filter.may_contain(elem); }
+    bool filtering() const { return extra != nullptr && extra->filter.enabled(); }
+
+    // find() without the logging, for both iterator flavours and for
+    // internal callers; an end() position if elem is absent
+    std::pair<Node*, std::size_t> locate(const T& elem) const;
+    // begin() without the logging, for walks the caller did not ask for
+    iterator leftmost() const;
+    template <typename U, typename M, typename O>
+    friend btree<U, M, O> set_union(const btree<U, M, O>& lhs, const btree<U, M, O>& rhs);
+    template <typename U, typename M, typename O>
+    friend btree<U, M, O> set_intersection(const btree<U, M, O>& lhs, const btree<U, M, O>& rhs);
+    template <typename U, typename M, typename O>
+    friend btree<U, M, O> set_difference(const btree<U, M, O>& lhs, const btree<U, M, O>& rhs);
+    bool recording() const { return extra != nullptr && extra->recorder != nullptr; }
+    void record(btree_op op, const T* elem) const { if (recording()) extra->recorder->record(op, elem); }
+
+    // the filter learns of elem once it has been added, or buffered
+    void note_insert(const T& elem);
+    // resizes the filter to at least expected elements and refills it
+    void refilter(std::size_t expected);
+    void refill(const node_ptr& node);
+
+    // in-order successor / predecessor shared by both iterator flavours;
+    // a null node stands for the inline buffer, or for end() when the
+    // index is end_index.  advance and retreat visit erased elements too,
+    // the step functions skip them.
+    void step_forward(Node*& node, std::size_t& index) const;
+    void step_backward(Node*& node, std::size_t& index) const;
+    void advance(Node*& node, std::size_t& index) const;
+    void retreat(Node*& node, std::size_t& index) const;
+    // the pointer that owns node (its parent's child slot, or root), for
+    // turning an iterator's node back into one; null if node is detached
+    node_ptr owning(const Node* node) const;
+
+    /**
+     * Small btrees keep their elements sorted in the inline buffer and have
+     * no root at all; the first insert past inline_capacity moves them
+     * into nodes.  Structural operations (split, join) work on nodes only
+     * and promote first; adopt() moves small results back inline.
+     */
+    static const std::size_t end_index = static_cast<std::size_t>(-1);
+    static const std::size_t find_batch_width = 16;
+    static const std::size_t inline_capacity = btree_inline_capacity<T>::value;
+    typedef btree_inline_storage<T, inline_capacity> inline_storage;
+
+    // iterators hand out T& into the buffer, just as they do into nodes
+    T* inline_data() const { return inline_storage::inline_data(); }
+    bool is_inline() const { return root == nullptr; }
+    void promote();
+    void demote();
+    void steal(btree<T, Monoid, Ownership>& other);
+    void assign_buffer(std::vector<T>& sorted);
+
+	node_ptr root;
+	node_ref tail;
 	std::size_t max_element;
     std::size_t btree_size = 0;
-    mutable std::size_t search_count = 0;
+    // tombstones not yet reclaimed, which btree_size does not count
+    std::size_t btree_dead = 0;
+    // buffer size per node (0 when not buffering) and messages pending
+    std::size_t buffer_limit = 0;
+    std::size_t buffered = 0;
+    Monoid monoid;
+
+    // The optional features, which most btrees never turn on, live apart
+    // so that until one is they cost a single pointer.  A copy keeps the
+    // filter and the cache's size, but starts the cache empty and leaves
+    // the recorder behind.
+    struct extras {
+        extras() {}
+        extras(const extras& other): filter(other.filter), cache(other.cache) {}
 
+        btree_filter<T> filter;
+        btree_cache<T, std::pair<Node*, std::size_t>> cache;
+        // the cache's notion of time, starting at 1 as 0 marks empty slots
+        std::uint64_t shape_version = 1;
+        btree_recorder<T>* recorder = nullptr;
+    };
+    std::unique_ptr<extras> extra;
+    // extra, made on first use
+    extras& features() {
+        if (extra == nullptr) extra.reset(new extras());
+        return *extra;
+    }
+    // extra for a copy of this btree
+    std::unique_ptr<extras> copy_features() const {
+        return std::unique_ptr<extras>(extra != nullptr ? new extras(*extra) : nullptr);
+    }
 };
 
-template <typename T>
-typename btree<T>::iterator btree<T>::begin() const{
-    search_count = 0;
-    std::weak_ptr<btree<T>::Node> cur = root;
-    while (cur.lock()->children[0] != nullptr) cur = cur.lock()->children[0];
-    return iterator(cur.lock(), 0, this);
+template <typename T, typename Monoid, typename Ownership>
+typename btree<T, Monoid, Ownership>::iterator btree<T, Monoid, Ownership>::begin() const{
+    record(btree_op::iterate, nullptr);
+    return leftmost();
 }
 
-template <typename T>
-typename btree<T>::const_iterator btree<T>::cbegin() const{
-    search_count = 0;
-    std::weak_ptr<btree<T>::Node> cur = root;
-    while (cur.lock()->children[0] != nullptr) cur = cur.lock()->children[0];
-    return iterator(cur.lock(), 0, this);
+template <typename T, typename Monoid, typename Ownership>
+typename btree<T, Monoid, Ownership>::iterator btree<T, Monoid, Ownership>::leftmost() const{
+    settle();
+    if (btree_size == 0) return end();
+    if (is_inline()) return iterator(nullptr, 0, this);
+    Node* cur = root.get();
+    while (cur->children[0] != nullptr) cur = cur->children[0].get();
+    std::size_t index = 0;
+    if (!cur->alive(index)) step_forward(cur, index);
+    return iterator(cur, index, this);
 }
 
-template <typename T>
-btree<T>::btree(std::size_t maxNodeElems): max_element{maxNodeElems} {}
+template <typename T, typename Monoid, typename Ownership>
+typename btree<T, Monoid, Ownership>::const_iterator btree<T, Monoid, Ownership>::cbegin() const{
+    return const_iterator(begin());
+}
 
-template <typename T>
-btree<T>::btree(const btree<T>& original): root{nullptr}, tail{root}, 
-max_element{original.max_element} {
-  std::queue<std::shared_ptr<btree<T>::Node>> copy_queue;
-  copy_queue.push(original.root);
-    while (copy_queue.size() != 0) {
-        std::weak_ptr<btree<T>::Node> cur = copy_queue.front();
-        copy_queue.pop();
-        for (auto insert_elem: cur.lock()->element) insert(insert_elem);
-
-        if (cur.lock()->full()) {
-            for (auto child: cur.lock()->children) { 
-                if (child != nullptr) copy_queue.push(child);
-            }
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::step_forward(Node*& node, std::size_t& index) const {
+    do advance(node, index); while (node != nullptr && !node->alive(index));
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::step_backward(Node*& node, std::size_t& index) const {
+    do retreat(node, index); while (node != nullptr && !node->alive(index));
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::advance(Node*& node, std::size_t& index) const {
+    if (node == nullptr) {
+        index = index + 1 < btree_size ? index + 1 : end_index;
+        return;
+    }
+    if (node->children[index + 1] != nullptr) {
+        // leftmost element of the subtree right of this element
+        node = node->children[index + 1].get();
+        while (node->children[0] != nullptr) node = node->children[0].get();
+        index = 0;
+        return;
+    }
+    if (index + 1 < node->element.size()) {
+        index++;
+        return;
+    }
+    // climb until we arrive from a child that has an element to its right
+    while (true) {
+        // the parent outlives the pointer taken from it, as the btree owns it
+        Node* parent = node->parent.lock().get();
+        if (parent == nullptr) {
+            node = nullptr;
+            index = end_index;
+            return;
+        }
+        std::size_t slot = parent->child_slot(node);
+        node = parent;
+        if (slot < node->element.size()) {
+            index = slot;
+            return;
         }
     }
 }
 
-template <typename T>
-btree<T>::btree(btree<T>&& original):
-    root(original.root),
-    tail(original.tail),
-    btree_size(original.btree_size),
-    max_element(original.max_element) {
-        original.root = nullptr;
-        original.tail.reset();
-        original.max_element = 0;
-        original.btree_size = 0;
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::retreat(Node*& node, std::size_t& index) const {
+    if (node == nullptr && index != end_index) {
+        index = index > 0 ? index - 1 : end_index;
+        return;
+    }
+    if (node == nullptr) {
+        // stepping back from end() lands on the largest element
+        settle();
+        node = root.get();
+        if (node == nullptr) {
+            index = btree_size - 1;
+            return;
+        }
+        while (node->children[node->element.size()] != nullptr) node = node->children[node->element.size()].get();
+        index = node->element.size() - 1;
+        return;
+    }
+    if (node->children[index] != nullptr) {
+        node = node->children[index].get();
+        while (node->children[node->element.size()] != nullptr) node = node->children[node->element.size()].get();
+        index = node->element.size() - 1;
+        return;
+    }
+    if (index > 0) {
+        index--;
+        return;
+    }
+    // climb as advance() does, until we arrive from a child that has an
+    // element to its left
+    while (true) {
+        Node* parent = node->parent.lock().get();
+        if (parent == nullptr) {
+            node = nullptr;
+            index = end_index;
+            return;
+        }
+        std::size_t slot = parent->child_slot(node);
+        node = parent;
+        if (slot > 0) {
+            index = slot - 1;
+            return;
+        }
     }
+}
 
-template <typename T>
-btree<T>& btree<T>::operator=(const btree<T>& rhs) {
+template <typename T, typename Monoid, typename Ownership>
+typename btree<T, Monoid, Ownership>::node_ptr btree<T, Monoid, Ownership>::owning(const Node* node) const {
+    node_ptr parent = node->parent.lock();
+    if (parent == nullptr) return root.get() == node ? root : nullptr;
+    for (const node_ptr& child : parent->children) {
+        if (child.get() == node) return child;
+    }
+    return nullptr;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+btree<T, Monoid, Ownership>::btree(std::size_t maxNodeElems, const Monoid& monoid): max_element{maxNodeElems}, monoid{monoid} {}
+
+template <typename T, typename Monoid, typename Ownership>
+btree<T, Monoid, Ownership>::btree(const btree<T, Monoid, Ownership>& original): root{nullptr}, tail{root},
+max_element{original.max_element}, buffer_limit{original.buffer_limit}, monoid{original.monoid},
+extra{original.copy_features()} {
+    assign_sorted(original.leftmost(), original.end());
+}
+
+template <typename T, typename Monoid, typename Ownership>
+btree<T, Monoid, Ownership>::btree(btree<T, Monoid, Ownership>&& original):
+    max_element(original.max_element),
+    buffer_limit(original.buffer_limit),
+    monoid(std::move(original.monoid)),
+    extra(std::move(original.extra)) {
+        // the recorder stays with original
+        if (recording()) {
+            original.features().recorder = extra->recorder;
+            extra->recorder = nullptr;
+        }
+        steal(original);
+    }
+
+template <typename T, typename Monoid, typename Ownership>
+btree<T, Monoid, Ownership>& btree<T, Monoid, Ownership>::operator=(const btree<T, Monoid, Ownership>& rhs) {
     if (this != &rhs) {
-        root.reset();
-        tail.reset();
         max_element = rhs.max_element;
-        btree_size = rhs.btree_size;
-        std::queue<std::shared_ptr<btree<T>::Node>> copy_queue;
-        copy_queue.push(rhs.root);
-        while (copy_queue.size() != 0) {
-            std::weak_ptr<btree<T>::Node> cur = copy_queue.front();
-            copy_queue.pop();
-            for (auto insert_elem: cur.lock()->element) insert(insert_elem);
-
-            if (cur.lock()->full()) {
-                for (auto child: cur.lock()->children) { 
-                    if (child != nullptr) copy_queue.push(child);
-                }
-            }
-        }
+        buffer_limit = rhs.buffer_limit;
+        monoid = rhs.monoid;
+        btree_recorder<T>* kept = recording() ? extra->recorder : nullptr;
+        extra = rhs.copy_features();
+        if (kept != nullptr) features().recorder = kept;
+        assign_sorted(rhs.leftmost(), rhs.end());
     }
     return *this;
 }
 
-template <typename T>
-btree<T>& btree<T>::operator=(btree<T>&& rhs) {
+template <typename T, typename Monoid, typename Ownership>
+btree<T, Monoid, Ownership>& btree<T, Monoid, Ownership>::operator=(btree<T, Monoid, Ownership>&& rhs) {
     if (this != &rhs) {
-        root.reset();
-        tail.reset();
+        clear();
         max_element = rhs.max_element;
-        root = rhs.root;
-        tail = rhs.tail;
-        max_element = rhs.max_element;
-        btree_size = rhs.btree_size;
+        buffer_limit = rhs.buffer_limit;
+        monoid = std::move(rhs.monoid);
+        // each recorder stays with its btree
+        btree_recorder<T>* kept = recording() ? extra->recorder : nullptr;
+        extra = std::move(rhs.extra);
+        if (recording()) rhs.features().recorder = extra->recorder;
+        if (kept != nullptr || extra != nullptr) features().recorder = kept;
+        steal(rhs);
+    }
+    return *this;
+}
 
-        rhs.root = nullptr;
-        rhs.tail.reset();
-        rhs.max_element = 0;
-        rhs.btree_size = 0;
+template <typename T, typename Monoid, typename Ownership>
+typename btree<T, Monoid, Ownership>::iterator btree<T, Monoid, Ownership>::find(const T& elem) {
+    record(btree_op::find, &elem);
+    std::pair<Node*, std::size_t> at = locate(elem);
+    return iterator(at.first, at.second, this);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+typename btree<T, Monoid, Ownership>::const_iterator btree<T, Monoid, Ownership>::find(const T& elem) const{
+    record(btree_op::find, &elem);
+    std::pair<Node*, std::size_t> at = locate(elem);
+    return const_iterator(at.first, at.second, this);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+std::pair<typename btree<T, Monoid, Ownership>::Node*, std::size_t> btree<T, Monoid, Ownership>::locate(const T& elem) const {
+    std::pair<Node*, std::size_t> missing(nullptr, end_index);
+    if (is_inline()) {
+        T* pos = std::lower_bound(inline_data(), inline_data() + btree_size, elem);
+        if (pos != inline_data() + btree_size && *pos == elem) return std::make_pair(nullptr, pos - inline_data());
+        return missing;
+    }
+    std::size_t index = 0;
+    Node* found = cached(elem, index);
+    bool pending = false;
+    if (found == nullptr) {
+        if (!may_contain(elem)) return missing;
+        Node* cur = root.get();
+        while (cur != nullptr) {
+            auto pos = std::lower_bound(cur->element.begin(), cur->element.end(), elem);
+            index = pos - cur->element.begin();
+            bool hit = pos != cur->element.end() && *pos == elem;
+            if (hit && cur->alive(index)) {
+                remember(elem, cur, index);
+                found = cur;
+                break;
+            }
+            if (!cur->buffer.empty()) pending = pending || std::binary_search(cur->buffer.begin(), cur->buffer.end(), elem);
+            // an erased elem is only there again if an insert of it is pending
+            if (hit) break;
+            cur = cur->children[index].get();
+        }
     }
+    if (found != nullptr && buffered == 0) return std::make_pair(found, index);
+    if (found == nullptr && !pending) return missing;
+    // the iterator handed out must step onto every pending insert on its way
+    settle();
+    return locate(elem);
 }
 
-template <typename T>
-typename btree<T>::iterator btree<T>::find(const T& elem) {
-    bool loop = true;
-    std::weak_ptr<Node> cur = root;
-    std::size_t index;
-    while (loop) {
-        for (index = 0; index < cur->element.size(); index++) {
-            if (elem == cur.lock()->element[index]) {
-                return iterator(cur.lock(), index, this);
-            }else if (elem < cur.lock()->element[index]){
-                if (cur.lock()->children[index] == nullptr) return end();
-                cur = cur.lock()->children[index];
-                loop = false;
+template <typename T, typename Monoid, typename Ownership>
+template <typename ForwardIt, typename OutputIt>
+OutputIt btree<T, Monoid, Ownership>::find_batch(ForwardIt first, ForwardIt last, OutputIt out) const {
+    settle();
+    if (recording()) {
+        for (ForwardIt key = first; key != last; ++key) record(btree_op::find, &*key);
+    }
+    if (is_inline()) {
+        for (; first != last; ++first) {
+            std::pair<Node*, std::size_t> at = locate(*first);
+            *out++ = const_iterator(at.first, at.second, this);
+        }
+        return out;
+    }
+    // a lookup goes through three stages per level: its node has been
+    // prefetched, then the node's elements, then the child slot below
+    enum stage { fetch_elements, search, descend, found, missed };
+    ForwardIt key[find_batch_width];
+    const node_ptr* node[find_batch_width];
+    std::size_t index[find_batch_width];
+    stage state[find_batch_width];
+    const_iterator missing = cend();
+
+    while (first != last) {
+        std::size_t group = 0;
+        for (; group < find_batch_width && first != last; ++group, ++first) {
+            key[group] = first;
+            node[group] = &root;
+            state[group] = may_contain(*first) ? fetch_elements : missed;
+        }
+        for (std::size_t pending = group; pending > 0; ) {
+            pending = 0;
+            for (std::size_t i = 0; i < group; ++i) {
+                const Node& cur = **node[i];
+                switch (state[i]) {
+                case fetch_elements: {
+                    const char* data = reinterpret_cast<const char*>(cur.element.data());
+                    const char* end = reinterpret_cast<const char*>(cur.element.data() + cur.element.size());
+                    for (; data < end; data += 64) btree_prefetch(data);
+                    state[i] = search;
+                    break;
+                }
+                case search: {
+                    auto pos = std::lower_bound(cur.element.begin(), cur.element.end(), *key[i]);
+                    index[i] = pos - cur.element.begin();
+                    if (pos != cur.element.end() && *pos == *key[i]) {
+                        state[i] = cur.alive(index[i]) ? found : missed;
+                        continue;
+                    }
+                    btree_prefetch(&cur.children[index[i]]);
+                    state[i] = descend;
+                    break;
+                }
+                case descend:
+                    if (cur.children[index[i]] == nullptr) {
+                        state[i] = missed;
+                        continue;
+                    }
+                    node[i] = &cur.children[index[i]];
+                    btree_prefetch(node[i]->get());
+                    state[i] = fetch_elements;
+                    break;
+                default:
+                    continue;
+                }
+                pending++;
             }
         }
-        if (index == cur.lock()->element.size()) {
-            if (cur.lock()->children[index] == nullptr) return end();
-            cur = cur.lock()->children[index];
+        for (std::size_t i = 0; i < group; ++i) {
+            if (state[i] == found) *out++ = const_iterator(node[i]->get(), index[i], this);
+            else *out++ = missing;
         }
     }
-    return end();
+    return out;
 }
 
-template <typename T>
-typename btree<T>::const_iterator btree<T>::find(const T& elem) const{
-    bool loop = true;
-    std::weak_ptr<Node> cur = root;
-    std::size_t index;
-    while (loop) {
-        for (index = 0; index < cur.lock()->element.size(); index++) {
-            if (elem == cur.lock()->element[index]) {
-                return iterator(cur.lock(), index, this);
-            }else if (elem < cur.lock()->element[index]){
-                if (cur.lock()->children[index] == nullptr) return cend();
-                cur = cur.lock()->children[index];
-                loop = false;
+template <typename T, typename Monoid, typename Ownership>
+std::pair<typename btree<T, Monoid, Ownership>::iterator, bool> btree<T, Monoid, Ownership>::insert(const T& elem) {
+    record(btree_op::insert, &elem);
+    settle();
+    std::pair<iterator, bool> result = insert_now(elem);
+    if (result.second) note_insert(elem);
+    return result;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+std::pair<typename btree<T, Monoid, Ownership>::iterator, bool> btree<T, Monoid, Ownership>::insert_now(const T& elem) {
+    if (is_inline()) {
+        T* first = inline_data();
+        T* last = first + btree_size;
+        T* pos = std::lower_bound(first, last, elem);
+        if (pos != last && *pos == elem) return std::make_pair(iterator(nullptr, pos - first, this), false);
+        if (btree_size < inline_capacity) {
+            if (pos == last) {
+                new (last) T(elem);
+            } else {
+                new (last) T(std::move(last[-1]));
+                std::move_backward(pos, last - 1, last);
+                *pos = elem;
             }
+            btree_size++;
+            return std::make_pair(iterator(nullptr, pos - first, this), true);
         }
-        if (index == cur.lock()->element.size()) {
-            if (cur.lock()->children[index] == nullptr) return cend();
-            cur = cur.lock()->children[index];
+        promote();
+        if (root == nullptr) {
+            // no inline buffer at all, the first element starts the root
+            root = make_node(elem, max_element);
+            recount(*root);
+            tail = root;
+            btree_size++;
+            return std::make_pair(iterator(root.get(), 0, this), true);
+        }
+    }
+    // appending past the largest element needs no descent
+    if (tail.lock()->element.back() < elem) return std::make_pair(append(elem), true);
+
+    node_ptr cur = root;
+    while (true) {
+        auto pos = std::lower_bound(cur->element.begin(), cur->element.end(), elem);
+        std::size_t index = pos - cur->element.begin();
+        if (pos != cur->element.end() && *pos == elem) {
+            if (cur->alive(index)) return std::make_pair(iterator(cur.get(), index, this), false);
+            revive(cur, index);
+            return std::make_pair(iterator(cur.get(), index, this), true);
         }
+        if (cur->children[index] == nullptr) return std::make_pair(place(cur, index, elem), true);
+        cur = cur->children[index];
     }
-    return cend();
 }
 
-template <typename T>
-std::pair<typename btree<T>::iterator, bool> btree<T>::insert(const T& elem) {
-    std::weak_ptr<Node> cur = root;
-    bool done = true; 
-    std::size_t index = 0;
-    if (cur.expired()) {
-        root = std::make_shared<btree<T>::Node> (Node(elem, max_element));
-        tail = root;
-        btree_size++;
-        return std::make_pair(iterator(cur.lock(), 0, this), true);
-    }
-    while (index < cur.lock()->element.size()){
-        if (elem == cur.lock()->element[index]) {
-            return std::make_pair(iterator(cur.lock(), 0, this), false);
-        }else if (elem < cur.lock()->element[index]) {
-            if (cur.lock()->full()) {
-                if (cur.lock()->children[index] != nullptr) {
-                    cur = cur.lock()->children[index];
+template <typename T, typename Monoid, typename Ownership>
+typename btree<T, Monoid, Ownership>::iterator btree<T, Monoid, Ownership>::insert(const const_iterator& hint, const T& elem) {
+    // settling may rebuild the subtree hint points into, so a hint taken
+    // while inserts were pending is not followed
+    record(btree_op::insert, &elem);
+    bool settled = buffered != 0;
+    settle();
+    std::size_t before = btree_size;
+    iterator pos = settled ? insert_now(elem).first : insert_near(hint, elem);
+    if (btree_size != before) note_insert(elem);
+    return pos;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+typename btree<T, Monoid, Ownership>::iterator btree<T, Monoid, Ownership>::insert_near(const const_iterator& hint, const T& elem) {
+    if (is_inline()) return insert_now(elem).first;
+    Node* node = hint.node;
+    if (node == nullptr) {
+        if (tail.lock()->element.back() < elem) return append(elem);
+        return insert_now(elem).first;
+    }
+    if (!(elem < node->element[hint.index])) {
+        if (elem == node->element[hint.index] && node->alive(hint.index)) return iterator(node, hint.index, this);
+        return insert_now(elem).first;
+    }
+    // elem goes right before hint only if it also follows hint's
+    // predecessor, counting erased elements, which still hold their place
+    Node* previous = node;
+    std::size_t before = hint.index;
+    retreat(previous, before);
+    if (previous != nullptr && !(previous->element[before] < elem)) {
+        if (previous->element[before] == elem && previous->alive(before)) return iterator(previous, before, this);
+        return insert_now(elem).first;
+    }
+    if (node->children[hint.index] == nullptr) return place(owning(node), hint.index, elem);
+    // hint has a left subtree, whose largest element is the predecessor
+    return place(owning(previous), before + 1, elem);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::set_insert_buffer(std::size_t messages) {
+    buffer_limit = messages;
+    if (buffer_limit == 0) flush();
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::insert_buffered(const T& elem) {
+    record(btree_op::insert, &elem);
+    if (buffer_limit == 0 || is_inline()) {
+        if (insert_now(elem).second) note_insert(elem);
+        return;
+    }
+    std::vector<T>& pending = root->buffer;
+    auto pos = std::lower_bound(pending.begin(), pending.end(), elem);
+    if (pos != pending.end() && *pos == elem) return;
+    // elem may still be present further down; the filter counts it anyway
+    note_insert(elem);
+    pending.insert(pos, elem);
+    buffered++;
+    if (pending.size() < buffer_limit) return;
+    std::vector<T> ready;
+    std::vector<landing> landings;
+    spill(root, ready, landings, false);
+    apply(ready, landings);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::flush() {
+    if (buffered == 0) return;
+    std::vector<T> ready;
+    std::vector<landing> landings;
+    spill(root, ready, landings, true);
+    apply(ready, landings);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+bool btree<T, Monoid, Ownership>::contains(const T& elem) const {
+    record(btree_op::contains, &elem);
+    if (is_inline()) return std::binary_search(inline_data(), inline_data() + btree_size, elem);
+    std::size_t known;
+    if (cached(elem, known) != nullptr) return true;
+    if (!may_contain(elem)) return false;
+    Node* cur = root.get();
+    while (cur != nullptr) {
+        auto pos = std::lower_bound(cur->element.begin(), cur->element.end(), elem);
+        std::size_t index = pos - cur->element.begin();
+        bool hit = pos != cur->element.end() && *pos == elem;
+        if (hit && cur->alive(index)) {
+            remember(elem, cur, index);
+            return true;
+        }
+        if (!cur->buffer.empty() && std::binary_search(cur->buffer.begin(), cur->buffer.end(), elem)) return true;
+        if (hit) return false;
+        cur = cur->children[index].get();
+    }
+    return false;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+typename btree<T, Monoid, Ownership>::Node* btree<T, Monoid, Ownership>::cached(const T& elem, std::size_t& index) const {
+    std::pair<Node*, std::size_t> pos;
+    auto matches = [&elem](const std::pair<Node*, std::size_t>& at) {
+        const Node& node = *at.first;
+        return at.second < node.element.size() && node.alive(at.second) && node.element[at.second] == elem;
+    };
+    if (extra == nullptr || !extra->cache.lookup(elem, extra->shape_version, pos, matches)) return nullptr;
+    index = pos.second;
+    return pos.first;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::set_filter(double false_positive_rate, std::size_t expected_elements) {
+    if (false_positive_rate == 0 && extra == nullptr) return;
+    features().filter.reset(0, false_positive_rate);
+    refilter(expected_elements);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::note_insert(const T& elem) {
+    if (!filtering()) return;
+    if (extra->filter.full()) refilter(2 * (btree_size + buffered));
+    extra->filter.add(elem);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::refilter(std::size_t expected) {
+    std::size_t least = 1024;
+    btree_filter<T>& filter = extra->filter;
+    filter.reset(std::max(std::max(expected, btree_size + buffered), least), filter.rate());
+    if (!filter.enabled()) return;
+    if (is_inline()) {
+        for (std::size_t i = 0; i < btree_size; ++i) filter.add(inline_data()[i]);
+    }
+    refill(root);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::refill(const node_ptr& node) {
+    if (node == nullptr) return;
+    for (std::size_t i = 0; i < node->element.size(); ++i) {
+        if (node->alive(i)) extra->filter.add(node->element[i]);
+    }
+    for (const T& elem : node->buffer) extra->filter.add(elem);
+    for (std::size_t slot = 0; slot <= node->element.size(); ++slot) refill(node->children[slot]);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::spill(const node_ptr& node, std::vector<T>& ready, std::vector<landing>& landings, bool all) {
+    std::vector<T> messages;
+    messages.swap(node->buffer);
+    // both the messages and the elements are sorted, so a single merge-like
+    // pass finds the slot each message goes down
+    std::size_t next = 0;
+    for (std::size_t slot = 0; slot <= node->element.size(); ++slot) {
+        std::size_t first = next;
+        bool last_slot = slot == node->element.size();
+        while (next < messages.size() && (last_slot || messages[next] < node->element[slot])) next++;
+        const node_ptr& child = node->children[slot];
+        if (child == nullptr) {
+            if (first < next) {
+                landings.push_back(landing{node, slot, ready.size(), ready.size() + (next - first)});
+                ready.insert(ready.end(), std::make_move_iterator(messages.begin() + first),
+                    std::make_move_iterator(messages.begin() + next));
+            }
+        } else {
+            if (first < next) absorb(*child, messages.data() + first, messages.data() + next);
+            if (all || child->buffer.size() >= buffer_limit) spill(child, ready, landings, all);
+        }
+        // a message matching the element itself inserts nothing, unless
+        // the element was erased
+        if (!last_slot && next < messages.size() && messages[next] == node->element[slot]) {
+            if (!node->alive(slot)) revive(node, slot);
+            next++;
+            buffered--;
+        }
+    }
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::apply(const std::vector<T>& ready, const std::vector<landing>& landings) {
+    buffered -= ready.size();
+    // Right to left, so that filling one slot never shifts the index of a
+    // slot still to come in the same node.  Nothing lies between a slot's
+    // neighbours but its own messages, so each message after the first goes
+    // in the gap right after the one before it.
+    for (auto at = landings.rbegin(); at != landings.rend(); ++at) {
+        node_ptr cur = at->node;
+        std::size_t index = at->slot;
+        for (std::size_t i = at->first; i < at->last; ++i) {
+            const T& elem = ready[i];
+            if (tail.lock()->element.back() < elem) {
+                append(elem);
+                continue;
+            }
+            if (i != at->first) {
+                if (cur->children[index + 1] == nullptr) {
+                    index++;
+                } else {
+                    cur = cur->children[index + 1];
+                    while (cur->children[0] != nullptr) cur = cur->children[0];
                     index = 0;
-                    continue;
                 }
-                cur.lock()->children[index] = std::make_shared<btree<T>::Node> (Node(elem, max_element, cur.lock()));
-                btree_size++;
-                if (elem > tail.lock()->element.back()) tail = cur.lock()->children[index];
-                return std::make_pair(iterator(cur.lock(), 0, this), true);
             }
-            auto insert_iter = cur.lock()->element.begin();
-            cur.lock()->element.insert(insert_iter + index, elem);
-            btree_size++;
-            return std::make_pair(iterator(cur.lock(), index, this), true);
+            node_ptr scapegoat = store(cur, index, elem);
+            if (scapegoat == nullptr) continue;
+            // the rebuild may free the nodes the other landings point into
+            rebuild(scapegoat);
+            for (++i; i < at->last; ++i) insert_now(ready[i]);
+            for (std::size_t j = 0; j < at->first; ++j) insert_now(ready[j]);
+            return;
         }
-        index++;
     }
-    if (index == cur.lock()->capacity){
-        if (cur.lock()->children[index] == nullptr) {
-            cur.lock()->children[index] = std::make_shared<Node> (Node(elem, max_element, cur.lock()));
-            btree_size++;
-            if (elem > tail.lock()->element.back()) tail = cur.lock()->children[index];
-            return std::make_pair(iterator(cur.lock(), index, this), true);
-        }
-        cur = cur.lock()->children[index];
-    }else{
-        if (done){
-            auto insert_iter = cur.lock()->element.begin();
-            cur.lock()->element.insert(insert_iter + index, elem);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::apply(const std::vector<T>& messages) {
+    buffered -= messages.size();
+    for (const T& elem : messages) insert_now(elem);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::absorb(Node& node, const T* first, const T* last) {
+    std::size_t incoming = last - first;
+    if (node.buffer.empty()) {
+        node.buffer.assign(first, last);
+        return;
+    }
+    std::vector<T> merged;
+    merged.reserve(node.buffer.size() + incoming);
+    std::set_union(node.buffer.begin(), node.buffer.end(), first, last, std::back_inserter(merged));
+    buffered -= node.buffer.size() + incoming - merged.size();
+    node.buffer.swap(merged);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::rehome(Node& node, std::vector<T>& messages) {
+    std::sort(messages.begin(), messages.end());
+    std::size_t gathered = messages.size();
+    messages.erase(std::unique(messages.begin(), messages.end()), messages.end());
+    buffered -= gathered - messages.size();
+    absorb(node, messages.data(), messages.data() + messages.size());
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::cut_buffer(Node& node, const T& bound, std::vector<T>& out) {
+    auto pos = std::lower_bound(node.buffer.begin(), node.buffer.end(), bound);
+    out.insert(out.end(), std::make_move_iterator(pos), std::make_move_iterator(node.buffer.end()));
+    node.buffer.erase(pos, node.buffer.end());
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::gather_buffers(const node_ptr& node, std::vector<T>& out) {
+    if (node == nullptr) return;
+    out.insert(out.end(), std::make_move_iterator(node->buffer.begin()), std::make_move_iterator(node->buffer.end()));
+    node->buffer.clear();
+    for (std::size_t slot = 0; slot <= node->element.size(); ++slot) gather_buffers(node->children[slot], out);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+typename btree<T, Monoid, Ownership>::iterator btree<T, Monoid, Ownership>::place(node_ptr cur, std::size_t index, const T& elem) {
+    node_ptr scapegoat = store(cur, index, elem);
+    if (scapegoat == nullptr) return iterator(cur.get(), index, this);
+    rebuild(scapegoat);
+    // elem is not in the filter until its insert returns, so this is a
+    // plain descent rather than locate()
+    Node* node = root.get();
+    while (true) {
+        auto pos = std::lower_bound(node->element.begin(), node->element.end(), elem);
+        index = pos - node->element.begin();
+        if (pos != node->element.end() && *pos == elem) return iterator(node, index, this);
+        node = node->children[index].get();
+    }
+}
+
+template <typename T, typename Monoid, typename Ownership>
+typename btree<T, Monoid, Ownership>::node_ptr btree<T, Monoid, Ownership>::store(node_ptr& cur, std::size_t& index, const T& elem) {
+    bool grown = cur->full();
+    if (grown) {
+        // a full node grows a child, the new element starts it
+        cur->children[index] = make_node(elem, max_element, cur);
+        cur = cur->children[index];
+        index = 0;
+    } else {
+        // the slot we landed in is empty, so it simply splits in two
+        cur->element.insert(cur->element.begin() + index, elem);
+        cur->mark_added(index, false);
+        cur->children.insert(cur->children.begin() + index + 1, nullptr);
+        cur->children.pop_back();
+    }
+
+    // Nodes never split, so ordered input would otherwise grow a chain of
+    // full nodes.  When a new node makes some subtree more than twice as
+    // tall as a perfectly packed one, the topmost such subtree is rebuilt
+    // (as in a scapegoat tree), which keeps the amortised cost logarithmic.
+    node_ptr scapegoat;
+    std::size_t height = 1;
+    for (node_ptr up = cur; up != nullptr; up = up->parent.lock()) {
+        up->subtree_size++;
+        refresh_summary(*up);
+        if (grown) {
+            if (up != cur) up->subtree_nodes++;
+            std::size_t packed = 1;
+            for (std::size_t rest = up->subtree_size; rest > max_element; rest /= max_element + 1) packed++;
+            if (height > 2 * packed + 1) scapegoat = up;
+            height++;
+        }
+    }
+    btree_size++;
+    if (tail.lock()->element.back() < elem) tail = cur;
+    return scapegoat;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+typename btree<T, Monoid, Ownership>::iterator btree<T, Monoid, Ownership>::append(const T& elem) {
+    node_ptr last = tail.lock();
+    if (!last->full() || last->element.size() < 2) return place(last, last->element.size(), elem);
+
+    // The tail is full: split the right spine the way a B-tree would.  The
+    // tail's largest element is carried up to the first ancestor with room,
+    // and every full ancestor passed on the way gets a new (element-less)
+    // right sibling, so the new leaf ends up as deep as the old one.
+    T carry = std::move(last->element.back());
+    bool carry_dead = !last->alive(last->element.size() - 1);
+    last->element.pop_back();
+    last->mark_removed(last->element.size());
+    node_ptr fresh = make_node(elem, max_element);
+    recount(*fresh);
+    node_ptr branch = fresh;
+    node_ptr below = last;
+    recount(*below);
+    // every node passed now ends at carry; its buffered messages beyond
+    // that move up to the node that takes carry
+    std::vector<T> displaced;
+    node_ptr top;
+    while (true) {
+        cut_buffer(*below, carry, displaced);
+        node_ptr parent = below->parent.lock();
+        if (parent == nullptr) {
+            root = make_node(carry, max_element);
+            root->mark_added(0, carry_dead);
+            top = root;
+            root->children[0] = below;
+            root->children[1] = branch;
+            below->parent = root;
+            branch->parent = root;
+            recount(*root);
+            break;
+        }
+        if (!parent->full()) {
+            top = parent;
+            parent->element.push_back(std::move(carry));
+            parent->mark_added(parent->element.size() - 1, carry_dead);
+            parent->children[parent->element.size()] = branch;
+            branch->parent = parent;
+            recount(*parent);
+            for (node_ptr up = parent->parent.lock(); up != nullptr; up = up->parent.lock()) {
+                up->subtree_size++;
+                up->subtree_nodes += branch->subtree_nodes;
+                refresh_summary(*up);
+            }
+            break;
+        }
+        node_ptr sibling = make_node(max_element);
+        sibling->children[0] = branch;
+        branch->parent = sibling;
+        recount(*sibling);
+        branch = sibling;
+        below = parent;
+        recount(*below);
+    }
+    if (!displaced.empty()) rehome(*top, displaced);
+    btree_size++;
+    tail = fresh;
+    return iterator(fresh.get(), 0, this);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::flatten(const node_ptr& node, std::vector<T>& out) const {
+    if (node == nullptr) return;
+    for (std::size_t i = 0; i < node->element.size(); ++i) {
+        flatten(node->children[i], out);
+        if (node->alive(i)) out.push_back(node->element[i]);
+    }
+    flatten(node->children[node->element.size()], out);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::free_subtree(const node_ptr& node) {
+    if (!Ownership::manual || node == nullptr) return;
+    for (const node_ptr& child : node->children) free_subtree(child);
+    free_node(node);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::rebuild(const node_ptr& node) {
+    reshaped();
+    std::vector<T> sorted;
+    sorted.reserve(node->subtree_size);
+    flatten(node, sorted);
+    std::vector<T> messages;
+    gather_buffers(node, messages);
+    node_ptr parent = node->parent.lock();
+    node_ptr packed = build_sorted(sorted.data(), sorted.size(), parent);
+    if (parent == nullptr) root = packed;
+    else parent->children[parent->child_slot(node.get())] = packed;
+    btree_dead -= node->subtree_dead;
+    free_subtree(node);
+
+    // the tombstones are gone, and if nothing else was left, so is the subtree
+    node_ptr above = packed == nullptr ? prune(parent, messages) : parent;
+    for (node_ptr up = above; up != nullptr; up = up->parent.lock()) recount(*up);
+    reset_tail();
+    if (messages.empty()) return;
+    if (packed != nullptr) rehome(*packed, messages);
+    else if (above != nullptr) rehome(*above, messages);
+    else apply(messages);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::kill(const node_ptr& node, std::size_t index) {
+    if (node->dead.empty()) node->dead.assign(node->element.size(), 0);
+    node->dead[index] = 1;
+    for (node_ptr up = node; up != nullptr; up = up->parent.lock()) {
+        up->subtree_size--;
+        up->subtree_dead++;
+        refresh_summary(*up);
+    }
+    btree_size--;
+    btree_dead++;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::revive(const node_ptr& node, std::size_t index) {
+    node->dead[index] = 0;
+    for (node_ptr up = node; up != nullptr; up = up->parent.lock()) {
+        up->subtree_size++;
+        up->subtree_dead--;
+        refresh_summary(*up);
+    }
+    btree_size++;
+    btree_dead--;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::unlink(const node_ptr& node, std::size_t index) {
+    reshaped();
+    // A tombstone with an empty child slot on either side is removed by
+    // closing the gap.  Otherwise its predecessor, the largest element of
+    // the subtree on its left, takes its place (tombstone or not), and it
+    // is the predecessor's old slot that closes.
+    node_ptr holder = node;
+    std::size_t slot = index;
+    if (node->children[index] != nullptr && node->children[index + 1] != nullptr) {
+        holder = node->children[index];
+        while (holder->children[holder->element.size()] != nullptr) holder = holder->children[holder->element.size()];
+        slot = holder->element.size() - 1;
+        // The subtrees on the way down to it now end at the predecessor,
+        // so their pending inserts beyond it move up to node, and those of
+        // the predecessor itself are applied (reviving it if it was erased).
+        std::vector<T> displaced;
+        for (node_ptr up = holder; up != node; up = up->parent.lock()) {
+            cut_buffer(*up, holder->element[slot], displaced);
+        }
+        auto copies = std::remove(displaced.begin(), displaced.end(), holder->element[slot]);
+        bool pending = copies != displaced.end();
+        buffered -= displaced.end() - copies;
+        displaced.erase(copies, displaced.end());
+        if (!displaced.empty()) rehome(*node, displaced);
+        if (pending && !holder->alive(slot)) {
             btree_size++;
-            return std::make_pair(iterator(cur.lock(), index, this), true);
+            btree_dead--;
         }
+        node->element[index] = std::move(holder->element[slot]);
+        node->dead[index] = holder->alive(slot) || pending ? 0 : 1;
     }
-    return std::make_pair(iterator(std::make_shared<Node>(), 0, this), false);
+    node_ptr kept = holder->children[slot] != nullptr ? holder->children[slot] : holder->children[slot + 1];
+    holder->element.erase(holder->element.begin() + slot);
+    holder->mark_removed(slot);
+    holder->children.erase(holder->children.begin() + slot);
+    holder->children[slot] = kept;
+    holder->children.push_back(nullptr);
+
+    node_ptr up = holder;
+    if (holder->element.empty()) {
+        // the emptied node is replaced by its only remaining subtree
+        up = holder->parent.lock();
+        if (kept != nullptr) kept->parent = up;
+        if (up != nullptr) up->children[up->child_slot(holder.get())] = kept;
+        else root = kept;
+        std::vector<T> messages;
+        messages.swap(holder->buffer);
+        free_node(holder);
+        if (kept == nullptr) up = prune(up, messages);
+        if (!messages.empty()) {
+            if (up != nullptr) rehome(*up, messages);
+            else if (root != nullptr) rehome(*root, messages);
+            else apply(messages);
+        }
+    }
+    btree_dead--;
+    for (; up != nullptr; up = up->parent.lock()) recount(*up);
+    reset_tail();
 }
 
+template <typename T, typename Monoid, typename Ownership>
+typename btree<T, Monoid, Ownership>::node_ptr
+btree<T, Monoid, Ownership>::prune(node_ptr node, std::vector<T>& messages) {
+    while (node != nullptr && node->element.empty() && node->children[0] == nullptr) {
+        node_ptr parent = node->parent.lock();
+        if (parent == nullptr) root = nullptr;
+        else parent->children[parent->child_slot(node.get())] = nullptr;
+        messages.insert(messages.end(), std::make_move_iterator(node->buffer.begin()),
+            std::make_move_iterator(node->buffer.end()));
+        free_node(node);
+        node = parent;
+    }
+    return node;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+bool btree<T, Monoid, Ownership>::unbuffer(Node& node, const T& elem) {
+    auto pos = std::lower_bound(node.buffer.begin(), node.buffer.end(), elem);
+    if (pos == node.buffer.end() || !(*pos == elem)) return false;
+    node.buffer.erase(pos);
+    buffered--;
+    return true;
+}
 
+template <typename T, typename Monoid, typename Ownership>
+std::size_t btree<T, Monoid, Ownership>::erase(const T& elem) {
+    record(btree_op::erase, &elem);
+    if (is_inline()) {
+        T* first = inline_data();
+        T* last = first + btree_size;
+        T* pos = std::lower_bound(first, last, elem);
+        if (pos == last || !(*pos == elem)) return 0;
+        std::move(pos + 1, last, pos);
+        last[-1].~T();
+        btree_size--;
+        return 1;
+    }
+    // pending inserts of elem can only be in the buffers along its path
+    bool pending = false;
+    node_ptr cur = root;
+    while (cur != nullptr) {
+        if (!cur->buffer.empty()) pending = unbuffer(*cur, elem) || pending;
+        auto pos = std::lower_bound(cur->element.begin(), cur->element.end(), elem);
+        std::size_t index = pos - cur->element.begin();
+        if (pos != cur->element.end() && *pos == elem) {
+            if (!cur->alive(index)) break;
+            kill(cur, index);
+            return 1;
+        }
+        cur = cur->children[index];
+    }
+    return pending ? 1 : 0;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+typename btree<T, Monoid, Ownership>::iterator btree<T, Monoid, Ownership>::erase(const const_iterator& pos) {
+    record(btree_op::erase, &*pos);
+    Node* node = pos.node;
+    std::size_t index = pos.index;
+    if (node == nullptr) {
+        // the inline buffer closes up, so the next element moves into index
+        T* first = inline_data();
+        std::move(first + index + 1, first + btree_size, first + index);
+        first[btree_size - 1].~T();
+        btree_size--;
+        return index < btree_size ? iterator(nullptr, index, this) : end();
+    }
+    if (node->alive(index)) {
+        node_ptr held = owning(node);
+        for (node_ptr up = held; up != nullptr; up = up->parent.lock()) {
+            if (!up->buffer.empty()) unbuffer(*up, node->element[index]);
+        }
+        kill(held, index);
+    }
+    step_forward(node, index);
+    return iterator(node, index, this);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+bool btree<T, Monoid, Ownership>::compact(std::size_t budget) {
+    std::size_t granted = budget;
+    reclaim(budget);
+    tighten(budget);
+    bool worked = budget != granted;
+    if (!is_inline() && btree_size <= inline_capacity && buffered == 0) {
+        adopt(root);
+        worked = true;
+    }
+    return worked;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::reclaim(std::size_t& budget) {
+    while (btree_dead > 0 && budget > 0) {
+        // head for the tombstones until the subtree around them fits
+        node_ptr cur = root;
+        while (cur->subtree_size + cur->subtree_dead > budget) {
+            std::size_t slot = 0;
+            while (slot <= cur->element.size() && dead_of(cur->children[slot]) == 0) ++slot;
+            if (slot > cur->element.size()) break;
+            cur = cur->children[slot];
+        }
+        std::size_t weight = cur->subtree_size + cur->subtree_dead;
+        if (weight <= budget) {
+            budget -= weight;
+            rebuild(cur);
+            continue;
+        }
+        // the tombstone is in cur itself, above subtrees too large to rebuild
+        std::size_t index = 0;
+        while (cur->alive(index)) ++index;
+        budget -= budget < cur->element.size() ? budget : cur->element.size();
+        unlink(cur, index);
+    }
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::tighten(std::size_t& budget) {
+    while (budget > 0 && root != nullptr) {
+        // follow the children with the most nodes to spare until the
+        // subtree fits; it is rebuilt if it is loose enough to be worth it.
+        // On the way down, children that fit into the node above are
+        // merged into it, which also works where no subtree fits.
+        bool folded = false;
+        node_ptr cur = root;
+        while (cur != nullptr && cur->subtree_size + cur->subtree_dead > budget) {
+            for (std::size_t slot = 0; slot <= cur->element.size() && budget > 0; ++slot) {
+                const node_ptr& child = cur->children[slot];
+                if (child == nullptr || cur->element.size() + child->element.size() > max_element) continue;
+                budget -= budget < child->element.size() + 1 ? budget : child->element.size() + 1;
+                fold(cur, slot);
+                folded = true;
+            }
+            node_ptr loosest;
+            std::size_t most = 0;
+            for (std::size_t slot = 0; slot <= cur->element.size(); ++slot) {
+                const node_ptr& child = cur->children[slot];
+                if (child == nullptr) continue;
+                std::size_t packed = packed_nodes(child->subtree_size);
+                std::size_t spare = child->subtree_nodes > packed ? child->subtree_nodes - packed : 0;
+                if (spare > most) {
+                    most = spare;
+                    loosest = child;
+                }
+            }
+            cur = loosest;
+        }
+        if (folded) reset_tail();
+        std::size_t packed = cur == nullptr ? 0 : packed_nodes(cur->subtree_size);
+        if (cur == nullptr || cur->subtree_nodes <= packed + packed / 4) {
+            if (folded) continue;
+            return;
+        }
+        budget -= cur->subtree_size + cur->subtree_dead;
+        rebuild(cur);
+    }
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::fold(const node_ptr& node, std::size_t slot) {
+    reshaped();
+    // the child's elements and children take the place of the slot
+    node_ptr child = node->children[slot];
+    std::size_t count = child->element.size();
+    if (!node->dead.empty() || !child->dead.empty()) {
+        if (node->dead.empty()) node->dead.assign(node->element.size(), 0);
+        if (child->dead.empty()) node->dead.insert(node->dead.begin() + slot, count, 0);
+        else node->dead.insert(node->dead.begin() + slot, child->dead.begin(), child->dead.end());
+    }
+    node->element.insert(node->element.begin() + slot, std::make_move_iterator(child->element.begin()),
+        std::make_move_iterator(child->element.end()));
+    node->children.erase(node->children.begin() + slot);
+    node->children.insert(node->children.begin() + slot, child->children.begin(), child->children.begin() + count + 1);
+    node->children.resize(node->capacity + 1);
+    for (std::size_t i = slot; i <= slot + count; ++i) {
+        if (node->children[i] != nullptr) node->children[i]->parent = node;
+    }
+    for (node_ptr up = node; up != nullptr; up = up->parent.lock()) up->subtree_nodes--;
+    if (!child->buffer.empty()) {
+        std::vector<T> messages;
+        messages.swap(child->buffer);
+        rehome(*node, messages);
+    }
+    free_node(child);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+std::size_t btree<T, Monoid, Ownership>::packed_nodes(std::size_t count) const {
+    if (count == 0) return 0;
+    if (count <= max_element) return 1;
+    // as build_sorted: just enough subtrees one level shorter, sharing the rest evenly
+    std::size_t full = max_element;
+    while (full * (max_element + 1) + max_element < count) full = full * (max_element + 1) + max_element;
+    std::size_t slots = (count + full + 1) / (full + 1);
+    std::size_t rest = count - (slots - 1);
+    std::size_t share = rest / slots;
+    std::size_t extra = rest % slots;
+    return 1 + extra * packed_nodes(share + 1) + (slots - extra) * packed_nodes(share);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+typename btree<T, Monoid, Ownership>::iterator btree<T, Monoid, Ownership>::select(std::size_t k) const {
+    settle();
+    if (k >= btree_size) return end();
+    if (is_inline()) return iterator(nullptr, k, this);
+    node_ptr cur = root;
+    while (true) {
+        std::size_t index = 0;
+        for (; index <= cur->element.size(); ++index) {
+            std::size_t below = count_of(cur->children[index]);
+            if (k < below) break;
+            k -= below;
+            if (index == cur->element.size()) break;
+            if (!cur->alive(index)) continue;
+            if (k == 0) return iterator(cur.get(), index, this);
+            k--;
+        }
+        cur = cur->children[index];
+    }
+}
+
+template <typename T, typename Monoid, typename Ownership>
+std::size_t btree<T, Monoid, Ownership>::rank(const T& elem) const {
+    settle();
+    if (is_inline()) return std::lower_bound(inline_data(), inline_data() + btree_size, elem) - inline_data();
+    std::size_t less = 0;
+    node_ptr cur = root;
+    while (cur != nullptr) {
+        auto pos = std::lower_bound(cur->element.begin(), cur->element.end(), elem);
+        std::size_t index = pos - cur->element.begin();
+        less += cur->alive_before(index);
+        for (std::size_t i = 0; i < index; ++i) less += count_of(cur->children[i]);
+        if (pos != cur->element.end() && *pos == elem) return less + count_of(cur->children[index]);
+        cur = cur->children[index];
+    }
+    return less;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+std::size_t btree<T, Monoid, Ownership>::index_of(const const_iterator& pos) const {
+    settle();
+    const Node* cur = pos.node;
+    if (cur == nullptr) return pos.index == end_index ? btree_size : pos.index;
+    std::size_t index = pos.index;
+    std::size_t before = cur->alive_before(index);
+    for (std::size_t i = 0; i <= index; ++i) before += count_of(cur->children[i]);
+    for (node_ptr parent = cur->parent.lock(); parent != nullptr; parent = parent->parent.lock()) {
+        std::size_t slot = parent->child_slot(cur);
+        before += parent->alive_before(slot);
+        for (std::size_t i = 0; i < slot; ++i) before += count_of(parent->children[i]);
+        cur = parent.get();
+    }
+    return before;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::refresh_summary(Node& node) const {
+    // nothing to fold, whether or not the optimiser would have seen it
+    if (std::is_same<Monoid, btree_no_summary>::value) return;
+    summary_type folded = summary_of(node.children[0]);
+    for (std::size_t i = 0; i < node.element.size(); ++i) {
+        if (node.alive(i)) folded = monoid.combine(folded, monoid.extract(node.element[i]));
+        folded = monoid.combine(folded, summary_of(node.children[i + 1]));
+    }
+    node.summary = folded;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+typename btree<T, Monoid, Ownership>::summary_type btree<T, Monoid, Ownership>::summary() const {
+    settle();
+    if (!is_inline()) return root->summary;
+    summary_type folded = monoid.identity();
+    for (std::size_t i = 0; i < btree_size; ++i) folded = monoid.combine(folded, monoid.extract(inline_data()[i]));
+    return folded;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+typename btree<T, Monoid, Ownership>::summary_type btree<T, Monoid, Ownership>::aggregate(const T& lo, const T& hi) const {
+    settle();
+    if (!(lo < hi)) return monoid.identity();
+    if (is_inline()) {
+        summary_type folded = monoid.identity();
+        T* last = std::lower_bound(inline_data(), inline_data() + btree_size, hi);
+        for (T* pos = std::lower_bound(inline_data(), last, lo); pos != last; ++pos) {
+            folded = monoid.combine(folded, monoid.extract(*pos));
+        }
+        return folded;
+    }
+    return aggregate_from(root, &lo, &hi);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+typename btree<T, Monoid, Ownership>::summary_type
+btree<T, Monoid, Ownership>::aggregate_from(const node_ptr& node, const T* lo, const T* hi) const {
+    // a null bound means the range is open on that side
+    if (node == nullptr) return monoid.identity();
+    if (lo == nullptr && hi == nullptr) return node->summary;
+    std::size_t first = 0;
+    std::size_t last = node->element.size();
+    if (lo != nullptr) first = std::lower_bound(node->element.begin(), node->element.end(), *lo) - node->element.begin();
+    if (hi != nullptr) last = std::lower_bound(node->element.begin(), node->element.end(), *hi) - node->element.begin();
+    // no element of this node is in range, so it all lies below one slot
+    if (first == last) return aggregate_from(node->children[first], lo, hi);
+
+    summary_type folded = aggregate_from(node->children[first], lo, nullptr);
+    for (std::size_t i = first; i < last; ++i) {
+        if (node->alive(i)) folded = monoid.combine(folded, monoid.extract(node->element[i]));
+        if (i + 1 < last) folded = monoid.combine(folded, summary_of(node->children[i + 1]));
+    }
+    return monoid.combine(folded, aggregate_from(node->children[last], nullptr, hi));
+}
+
+template <typename T, typename Monoid, typename Ownership>
+template <typename Predicate, typename Sink>
+std::size_t btree<T, Monoid, Ownership>::scan(const T& lo, const T& hi, Predicate predicate, Sink sink) const {
+    settle();
+    std::vector<T> batch;
+    batch.reserve(scan_batch);
+    std::size_t matched = 0;
+    if (is_inline()) {
+        const T* first = std::lower_bound(inline_data(), inline_data() + btree_size, lo);
+        const T* last = std::lower_bound(first, static_cast<const T*>(inline_data() + btree_size), hi);
+        matched += scan_run(first, last, nullptr, predicate, sink, batch);
+    } else if (lo < hi) {
+        matched += scan_node(root, &lo, &hi, predicate, sink, batch);
+    }
+    if (!batch.empty()) sink(batch.data(), batch.data() + batch.size());
+    return matched;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+template <typename Predicate, typename Sink>
+std::size_t btree<T, Monoid, Ownership>::scan_node(const node_ptr& node, const T* lo, const T* hi,
+    Predicate& predicate, Sink& sink, std::vector<T>& batch) const {
+    // a null bound means the range is open on that side
+    if (node == nullptr) return 0;
+    std::size_t first = 0;
+    std::size_t last = node->element.size();
+    if (lo != nullptr) first = std::lower_bound(node->element.begin(), node->element.end(), *lo) - node->element.begin();
+    if (hi != nullptr) last = std::lower_bound(node->element.begin() + first, node->element.end(), *hi) - node->element.begin();
+
+    // the elements between two non-empty child slots are consecutive in
+    // order, and in a leaf that is all of them
+    const T* elements = node->element.data();
+    const unsigned char* dead = node->dead.empty() ? nullptr : node->dead.data();
+    std::size_t matched = 0;
+    std::size_t run = first;
+    for (std::size_t slot = first; slot <= last; ++slot) {
+        if (node->children[slot] == nullptr) continue;
+        matched += scan_run(elements + run, elements + slot, dead ? dead + run : nullptr, predicate, sink, batch);
+        matched += scan_node(node->children[slot], slot == first ? lo : nullptr, slot == last ? hi : nullptr,
+            predicate, sink, batch);
+        run = slot;
+    }
+    return matched + scan_run(elements + run, elements + last, dead ? dead + run : nullptr, predicate, sink, batch);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+template <typename Predicate, typename Sink>
+std::size_t btree<T, Monoid, Ownership>::scan_run(const T* first, const T* last, const unsigned char* dead,
+    Predicate& predicate, Sink& sink, std::vector<T>& batch) const {
+    std::size_t matched = 0;
+    // The predicate is first evaluated over a whole chunk with no branch
+    // on its result, a loop compilers vectorise for arithmetic T and
+    // simple comparisons; only then are the matches copied out.
+    unsigned char keep[scan_chunk];
+    while (first < last) {
+        std::size_t count = last - first;
+        if (count > scan_chunk) count = scan_chunk;
+        for (std::size_t i = 0; i < count; ++i) keep[i] = predicate(first[i]) ? 1 : 0;
+        if (dead != nullptr) {
+            for (std::size_t i = 0; i < count; ++i) keep[i] &= dead[i] ^ 1;
+            dead += count;
+        }
+        if (batch.size() + count > scan_batch) {
+            sink(batch.data(), batch.data() + batch.size());
+            batch.clear();
+        }
+        std::size_t before = batch.size();
+        compact(first, keep, count, batch, std::integral_constant<bool,
+            std::is_trivially_copyable<T>::value && std::is_default_constructible<T>::value>());
+        matched += batch.size() - before;
+        first += count;
+    }
+    return matched;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::compact(const T* in, const unsigned char* keep, std::size_t count, std::vector<T>& batch,
+    std::true_type) {
+    // every element is written, and the end only advances past the kept ones
+    std::size_t size = batch.size();
+    batch.resize(size + count);
+    T* out = batch.data() + size;
+    for (std::size_t i = 0; i < count; ++i) {
+        *out = in[i];
+        out += keep[i];
+    }
+    batch.resize(out - batch.data());
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::compact(const T* in, const unsigned char* keep, std::size_t count, std::vector<T>& batch,
+    std::false_type) {
+    for (std::size_t i = 0; i < count; ++i) {
+        if (keep[i]) batch.push_back(in[i]);
+    }
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::recount(Node& node) const {
+    node.subtree_size = node.alive_before(node.element.size());
+    node.subtree_dead = node.element.size() - node.subtree_size;
+    if (node.subtree_dead == 0) node.dead.clear();
+    node.subtree_nodes = 1;
+    for (std::size_t i = 0; i <= node.element.size(); ++i) {
+        node.subtree_size += count_of(node.children[i]);
+        node.subtree_dead += dead_of(node.children[i]);
+        node.subtree_nodes += nodes_of(node.children[i]);
+    }
+    refresh_summary(node);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::adopt(node_ptr new_root) {
+    reshaped();
+    root = new_root;
+    btree_size = count_of(root);
+    btree_dead = dead_of(root);
+    buffered = 0;
+    if (root != nullptr) root->parent.reset();
+    if (btree_size <= inline_capacity) demote();
+    else reset_tail();
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::reset_tail() {
+    tail.reset();
+    if (root == nullptr) return;
+    node_ptr cur = root;
+    while (cur->children[cur->element.size()] != nullptr) cur = cur->children[cur->element.size()];
+    tail = cur;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::clear() {
+    reshaped();
+    if (is_inline()) {
+        for (std::size_t i = 0; i < btree_size; ++i) inline_data()[i].~T();
+    }
+    free_subtree(root);
+    root.reset();
+    tail.reset();
+    btree_size = 0;
+    btree_dead = 0;
+    buffered = 0;
+    if (extra != nullptr) extra->filter.clear();
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::promote() {
+    if (!is_inline() || btree_size == 0) return;
+    node_ptr built = build_sorted(inline_data(), btree_size, nullptr);
+    for (std::size_t i = 0; i < btree_size; ++i) inline_data()[i].~T();
+    root = built;
+    reset_tail();
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::demote() {
+    if (is_inline()) return;
+    reshaped();
+    std::vector<T> sorted(leftmost(), end());
+    free_subtree(root);
+    root.reset();
+    tail.reset();
+    btree_dead = 0;
+    for (std::size_t i = 0; i < sorted.size(); ++i) new (inline_data() + i) T(std::move(sorted[i]));
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::steal(btree<T, Monoid, Ownership>& other) {
+    reshaped();
+    btree_size = other.btree_size;
+    btree_dead = other.btree_dead;
+    buffered = other.buffered;
+    if (other.is_inline()) {
+        for (std::size_t i = 0; i < other.btree_size; ++i) new (inline_data() + i) T(std::move(other.inline_data()[i]));
+    } else {
+        // the nodes change hands, so other's clear() must not free them
+        root = other.root;
+        tail = other.tail;
+        other.root.reset();
+        other.btree_size = 0;
+    }
+    other.clear();
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::assign_buffer(std::vector<T>& sorted) {
+    clear();
+    if (sorted.size() > inline_capacity) {
+        adopt(build_sorted(sorted.data(), sorted.size(), nullptr));
+    } else {
+        for (std::size_t i = 0; i < sorted.size(); ++i) new (inline_data() + i) T(std::move(sorted[i]));
+        btree_size = sorted.size();
+    }
+    if (filtering()) refilter(extra->filter.capacity());
+}
+
+template <typename T, typename Monoid, typename Ownership>
+typename btree<T, Monoid, Ownership>::node_ptr
+btree<T, Monoid, Ownership>::build_sorted(const T* first, std::size_t count, const node_ptr& parent) const {
+    if (count == 0) return nullptr;
+    node_ptr node = make_node(max_element, parent);
+    if (count <= max_element) {
+        node->element.assign(first, first + count);
+    } else {
+        // Each subtree below is one level shorter than this one needs to
+        // be, so it can hold up to full elements; there are just enough of
+        // them to take the rest evenly, which keeps the nodes near the
+        // leaves, where most of them are, full.
+        std::size_t full = max_element;
+        while (full * (max_element + 1) + max_element < count) full = full * (max_element + 1) + max_element;
+        std::size_t slots = (count + full + 1) / (full + 1);
+        std::size_t rest = count - (slots - 1);
+        std::size_t share = rest / slots;
+        std::size_t extra = rest % slots;
+        node->element.reserve(slots - 1);
+        for (std::size_t slot = 0; slot < slots; ++slot) {
+            std::size_t below = share + (slot < extra ? 1 : 0);
+            node->children[slot] = build_sorted(first, below, node);
+            first += below;
+            if (slot + 1 < slots) node->element.push_back(*first++);
+        }
+    }
+    recount(*node);
+    return node;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+template <typename InputIt>
+void btree<T, Monoid, Ownership>::assign_sorted(InputIt first, InputIt last) {
+    std::vector<T> sorted(first, last);
+    assign_buffer(sorted);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+bool btree<T, Monoid, Ownership>::save(std::ostream& os) const {
+    settle();
+    btree_snapshot_header header;
+    header.element_size = sizeof(T);
+    header.count = btree_size;
+    header.write(os);
+    if (is_inline()) {
+        btree_io<T>::write(os, inline_data(), btree_size);
+    } else {
+        std::vector<T> block;
+        block.reserve(btree_size < save_block ? btree_size : save_block);
+        save_node(root, block, os);
+        if (!block.empty()) btree_io<T>::write(os, block.data(), block.size());
+    }
+    return static_cast<bool>(os);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::save_node(const node_ptr& node, std::vector<T>& block, std::ostream& os) const {
+    if (node == nullptr) return;
+    // as in scan_node, the elements between two non-empty child slots go
+    // out as one run
+    std::size_t run = 0;
+    for (std::size_t slot = 0; slot <= node->element.size(); ++slot) {
+        if (node->children[slot] == nullptr) continue;
+        save_run(*node, run, slot, block, os);
+        save_node(node->children[slot], block, os);
+        run = slot;
+    }
+    save_run(*node, run, node->element.size(), block, os);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::save_run(const Node& node, std::size_t first, std::size_t last, std::vector<T>& block,
+    std::ostream& os) const {
+    while (first < last) {
+        std::size_t count = std::min(last - first, save_block - block.size());
+        if (node.dead.empty()) {
+            block.insert(block.end(), node.element.begin() + first, node.element.begin() + first + count);
+        } else {
+            for (std::size_t i = first; i < first + count; ++i) {
+                if (node.alive(i)) block.push_back(node.element[i]);
+            }
+        }
+        first += count;
+        if (block.size() == save_block) {
+            btree_io<T>::write(os, block.data(), block.size());
+            block.clear();
+        }
+    }
+}
+
+template <typename T, typename Monoid, typename Ownership>
+bool btree<T, Monoid, Ownership>::load(std::istream& is) {
+    btree_snapshot_header header;
+    if (!header.read(is)) return false;
+    std::vector<T> sorted;
+    bool whole = header.element_size == sizeof(T);
+    // read a block at a time rather than trusting count with one allocation
+    while (whole && sorted.size() < header.count) {
+        std::uint64_t left = header.count - sorted.size();
+        std::size_t count = left < save_block ? static_cast<std::size_t>(left) : save_block;
+        std::size_t size = sorted.size();
+        sorted.resize(size + count);
+        whole = btree_io<T>::read(is, sorted.data() + size, count);
+        for (std::size_t i = std::max<std::size_t>(size, 1); whole && i < sorted.size(); ++i) {
+            whole = sorted[i - 1] < sorted[i];
+        }
+    }
+    if (!whole) {
+        is.setstate(std::ios::failbit);
+        return false;
+    }
+    assign_buffer(sorted);
+    return true;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void btree<T, Monoid, Ownership>::merge(const btree<T, Monoid, Ownership>& other) {
+    std::vector<T> merged;
+    merged.reserve(btree_size + other.btree_size);
+    std::set_union(leftmost(), end(), other.leftmost(), other.end(), std::back_inserter(merged));
+    assign_buffer(merged);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+std::pair<typename btree<T, Monoid, Ownership>::node_ptr, typename btree<T, Monoid, Ownership>::node_ptr>
+btree<T, Monoid, Ownership>::split_node(const node_ptr& node, const T& key) const {
+    if (node == nullptr) return std::make_pair(nullptr, nullptr);
+    auto pos = std::lower_bound(node->element.begin(), node->element.end(), key);
+    std::size_t index = pos - node->element.begin();
+    bool found = pos != node->element.end() && *pos == key;
+    // the subtree in the slot we cut through is split the same way
+    std::pair<node_ptr, node_ptr> below;
+    if (found) below.first = node->children[index];
+    else below = split_node(node->children[index], key);
+
+    node_ptr lower = below.first;
+    if (index > 0) {
+        lower = make_node(node->capacity);
+        lower->element.assign(std::make_move_iterator(node->element.begin()),
+            std::make_move_iterator(node->element.begin() + index));
+        if (!node->dead.empty()) lower->dead.assign(node->dead.begin(), node->dead.begin() + index);
+        for (std::size_t slot = 0; slot < index; ++slot) lower->children[slot] = node->children[slot];
+        lower->children[index] = below.first;
+        for (std::size_t slot = 0; slot <= index; ++slot) {
+            if (lower->children[slot] != nullptr) lower->children[slot]->parent = lower;
+        }
+        recount(*lower);
+    }
+
+    // node itself is reused for the upper half
+    node_ptr upper = below.second;
+    if (index < node->element.size()) {
+        upper = node;
+        upper->element.erase(upper->element.begin(), upper->element.begin() + index);
+        if (!upper->dead.empty()) upper->dead.erase(upper->dead.begin(), upper->dead.begin() + index);
+        upper->children.erase(upper->children.begin(), upper->children.begin() + index + 1);
+        upper->children.insert(upper->children.begin(), below.second);
+        upper->children.resize(upper->capacity + 1);
+        if (below.second != nullptr) below.second->parent = upper;
+        recount(*upper);
+    } else {
+        // every element went to lower
+        free_node(node);
+    }
+    return std::make_pair(lower, upper);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+btree<T, Monoid, Ownership> btree<T, Monoid, Ownership>::split(const T& key) {
+    flush();
+    promote();
+    std::pair<node_ptr, node_ptr> halves = split_node(root, key);
+    btree<T, Monoid, Ownership> upper(max_element, monoid);
+    upper.buffer_limit = buffer_limit;
+    // a filter for all the elements is still right for either half
+    if (filtering()) upper.features().filter = extra->filter;
+    adopt(halves.first);
+    upper.adopt(halves.second);
+    return upper;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+T btree<T, Monoid, Ownership>::pop_max() {
+    node_ptr cur = root;
+    while (cur->children[cur->element.size()] != nullptr) cur = cur->children[cur->element.size()];
+    T largest = std::move(cur->element.back());
+    cur->element.pop_back();
+    cur->mark_removed(cur->element.size());
+    node_ptr up = cur;
+    if (cur->element.empty()) {
+        // the emptied node is replaced by its only remaining subtree; an
+        // element-less parent on an appended spine may be left with none
+        node_ptr only = cur->children[0];
+        up = cur->parent.lock();
+        if (only != nullptr) only->parent = up;
+        if (up != nullptr) up->children[up->child_slot(cur.get())] = only;
+        else root = only;
+        free_node(cur);
+        std::vector<T> messages;
+        if (only == nullptr) up = prune(up, messages);
+    }
+    for (; up != nullptr; up = up->parent.lock()) recount(*up);
+    btree_size--;
+    reset_tail();
+    return largest;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+btree<T, Monoid, Ownership> btree<T, Monoid, Ownership>::join(btree<T, Monoid, Ownership> left, btree<T, Monoid, Ownership> right) {
+    left.flush();
+    right.flush();
+    // erased elements still hold their place in the order, so they go first
+    std::size_t unbounded = static_cast<std::size_t>(-1);
+    left.reclaim(unbounded);
+    right.reclaim(unbounded);
+    if (left.empty()) return right;
+    if (right.empty()) return left;
+    if (!(*std::prev(left.end()) < *right.leftmost())) {
+        btree<T, Monoid, Ownership> united = set_union(left, right);
+        if (left.filtering()) united.set_filter(left.extra->filter.rate());
+        return united;
+    }
+
+    // the largest element of left separates the two trees in a common node
+    left.promote();
+    right.promote();
+    T middle = left.pop_max();
+    node_ptr lower = left.root;
+    node_ptr upper = right.root;
+    left.adopt(nullptr);
+    right.adopt(nullptr);
+
+    node_ptr top;
+    if (lower != nullptr && !lower->full()) {
+        top = lower;
+        top->element.push_back(std::move(middle));
+        top->mark_added(top->element.size() - 1, false);
+        top->children[top->element.size()] = upper;
+    } else if (!upper->full()) {
+        top = upper;
+        top->element.insert(top->element.begin(), std::move(middle));
+        top->mark_added(0, false);
+        top->children.insert(top->children.begin(), lower);
+        top->children.pop_back();
+    } else {
+        top = make_node(middle, left.max_element);
+        top->children[0] = lower;
+        top->children[1] = upper;
+    }
+    if (lower != nullptr && lower != top) lower->parent = top;
+    if (upper != top) upper->parent = top;
+    left.recount(*top);
+
+    btree<T, Monoid, Ownership> joined(left.max_element, left.monoid);
+    joined.buffer_limit = left.buffer_limit;
+    bool merged = true;
+    if (left.filtering()) {
+        btree_filter<T>& filter = joined.features().filter;
+        filter = std::move(left.extra->filter);
+        merged = right.filtering() && filter.merge(right.extra->filter);
+    }
+    joined.adopt(top);
+    // the halves of a split each hold the whole filter, so a merged one
+    // may count the same elements twice; what counts is the joined size
+    if (joined.filtering() && (!merged || joined.extra->filter.capacity() < joined.btree_size)) {
+        joined.refilter(2 * joined.btree_size);
+    }
+    return joined;
+}
+
+/**
+ * Linear-time set algebra.  Each walks both btrees once in order and
+ * bulk builds the result, which uses lhs's node capacity and monoid.
+ */
+template <typename T, typename Monoid, typename Ownership>
+btree<T, Monoid, Ownership> set_union(const btree<T, Monoid, Ownership>& lhs, const btree<T, Monoid, Ownership>& rhs) {
+    std::vector<T> sorted;
+    sorted.reserve(lhs.size() + rhs.size());
+    std::set_union(lhs.leftmost(), lhs.end(), rhs.leftmost(), rhs.end(), std::back_inserter(sorted));
+    btree<T, Monoid, Ownership> result(lhs.get_max_elem(), lhs.get_monoid());
+    result.assign_sorted(sorted.begin(), sorted.end());
+    return result;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+btree<T, Monoid, Ownership> set_intersection(const btree<T, Monoid, Ownership>& lhs, const btree<T, Monoid, Ownership>& rhs) {
+    std::vector<T> sorted;
+    sorted.reserve(std::min(lhs.size(), rhs.size()));
+    std::set_intersection(lhs.leftmost(), lhs.end(), rhs.leftmost(), rhs.end(), std::back_inserter(sorted));
+    btree<T, Monoid, Ownership> result(lhs.get_max_elem(), lhs.get_monoid());
+    result.assign_sorted(sorted.begin(), sorted.end());
+    return result;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+btree<T, Monoid, Ownership> set_difference(const btree<T, Monoid, Ownership>& lhs, const btree<T, Monoid, Ownership>& rhs) {
+    std::vector<T> sorted;
+    sorted.reserve(lhs.size());
+    std::set_difference(lhs.leftmost(), lhs.end(), rhs.leftmost(), rhs.end(), std::back_inserter(sorted));
+    btree<T, Monoid, Ownership> result(lhs.get_max_elem(), lhs.get_monoid());
+    result.assign_sorted(sorted.begin(), sorted.end());
+    return result;
+}
+
+
+template <typename T, typename Monoid, typename Ownership>
+std::ostream& operator<<(std::ostream& os, const btree<T, Monoid, Ownership>& tree) {
+    typedef typename btree<T, Monoid, Ownership>::Node Node;
+    tree.settle();
+    if (tree.is_inline()) {
+        for (std::size_t i = 0; i < tree.btree_size; ++i) os << tree.inline_data()[i] << " ";
+        return os;
+    }
+    std::vector<const Node*> level(1, tree.root.get());
+    std::vector<const Node*> next;
+    while (!level.empty()) {
+        for (const Node* node : level) {
+            for (std::size_t i = 0; i < node->element.size(); ++i) {
+                if (node->alive(i)) os << node->element[i] << " ";
+            }
+            for (const auto& child : node->children) {
+                if (child != nullptr) next.push_back(child.get());
+            }
+        }
+        level.swap(next);
+        next.clear();
+    }
+    return os;
+}
 
 #endif
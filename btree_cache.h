@@ -0,0 +1,168 @@
+/**
+ * A small lookup cache for btrees.
+ *
+ * A btree_cache remembers where recently found elements live, as an
+ * opaque position (for a btree, a node and an index into it), in a
+ * table of two-slot buckets picked by the element's hash.  Replacement
+ * is CLOCK within a bucket: a slot that has hit since it was last passed
+ * over gets a second chance, so hot elements are not pushed out by the
+ * long tail of elements looked up only once.  Every slot is
+ * stamped with the owner's structural version when it is written; the
+ * owner bumps its version on any change that could leave a position
+ * dangling, which invalidates every slot at once without visiting them,
+ * and confirms each hit against the element at the position.  A lookup
+ * that hits costs a hash, one bucket and that comparison, in place of a
+ * descent from the root.
+ *
+ * Positions only mean something to the container that recorded them, so
+ * copying or moving a cache gives an empty one of the same size.
+ */
+
+#ifndef BTREE_CACHE_H
+#define BTREE_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "btree_filter.h"
+
+template <typename T, typename Position>
+class btree_cache {
+ public:
+  /**
+   * Constructs a disabled cache, which never hits.
+   */
+  btree_cache() {}
+
+  btree_cache(const btree_cache& other): buckets(other.buckets.size()), shift(other.shift) {}
+  btree_cache& operator=(const btree_cache& other);
+
+  /**
+   * Resizes the cache to entries slots, rounded up to a power of two
+   * (and at least four), and empties it.
+   *
+   * @param entries the number of positions to keep; 0 disables the cache.
+   */
+  void reset(std::size_t entries);
+
+  bool enabled() const { return !buckets.empty(); }
+
+  /**
+   * Looks elem up, counting the lookup and whether it hit.
+   *
+   * @param version the owner's current structural version.
+   * @param pos set to elem's position on a hit.
+   * @param matches called with a candidate position to confirm that elem
+   *        is the element there.
+   * @return whether pos was set.
+   */
+  template <typename Matches>
+  bool lookup(const T& elem, std::uint64_t version, Position& pos, Matches matches);
+
+  // records that elem was found at pos in the given version
+  void remember(const T& elem, std::uint64_t version, const Position& pos);
+
+  std::size_t hits() const { return hit_count; }
+  std::size_t lookups() const { return lookup_count; }
+  std::size_t capacity() const { return 2 * buckets.size(); }
+
+private:
+	struct slot {
+		Position pos{};
+		// 0 in empty slots; owners start counting at 1
+		std::uint64_t version = 0;
+		// the element's full hash, so most mismatches never look at pos
+		std::uint64_t hash = 0;
+	};
+	struct bucket {
+		slot way[2];
+		// per way, whether it hit since remember() last passed it over
+		bool referenced[2] = {false, false};
+		// the way remember() looks at first
+		unsigned char hand = 0;
+	};
+
+	static std::uint64_t hash_of(const T& elem) { return btree_hash<T>()(elem); }
+
+	// Fibonacci hashing, as std::hash is often the identity
+	bucket& bucket_of(std::uint64_t hash) {
+		return buckets[static_cast<std::size_t>((hash * 0x9e3779b97f4a7c15ULL) >> shift)];
+	}
+
+	std::vector<bucket> buckets;
+	unsigned shift = 64;
+	std::size_t hit_count = 0;
+	std::size_t lookup_count = 0;
+};
+
+template <typename T, typename Position>
+btree_cache<T, Position>& btree_cache<T, Position>::operator=(const btree_cache& other) {
+    if (this != &other) {
+        buckets.assign(other.buckets.size(), bucket());
+        shift = other.shift;
+        hit_count = 0;
+        lookup_count = 0;
+    }
+    return *this;
+}
+
+template <typename T, typename Position>
+void btree_cache<T, Position>::reset(std::size_t entries) {
+    buckets.clear();
+    shift = 64;
+    hit_count = 0;
+    lookup_count = 0;
+    if (!btree_hash<T>::available || entries == 0) return;
+    // a single bucket still needs a shift below 64 to be well-defined
+    std::size_t size = 2;
+    shift--;
+    while (2 * size < entries) {
+        size *= 2;
+        shift--;
+    }
+    buckets.resize(size);
+}
+
+template <typename T, typename Position>
+template <typename Matches>
+bool btree_cache<T, Position>::lookup(const T& elem, std::uint64_t version, Position& pos, Matches matches) {
+    if (!enabled()) return false;
+    lookup_count++;
+    std::uint64_t hash = hash_of(elem);
+    bucket& at = bucket_of(hash);
+    for (unsigned char way = 0; way < 2; ++way) {
+        const slot& candidate = at.way[way];
+        if (candidate.version != version || candidate.hash != hash || !matches(candidate.pos)) continue;
+        pos = candidate.pos;
+        at.referenced[way] = true;
+        hit_count++;
+        return true;
+    }
+    return false;
+}
+
+template <typename T, typename Position>
+void btree_cache<T, Position>::remember(const T& elem, std::uint64_t version, const Position& pos) {
+    if (!enabled()) return;
+    std::uint64_t hash = hash_of(elem);
+    bucket& at = bucket_of(hash);
+    // a stale way is free, whichever it is; otherwise the hand moves past
+    // referenced ways, clearing them, and elem is only let in if it finds
+    // one that is not
+    unsigned char way = at.way[0].version != version ? 0 : 1;
+    if (at.way[way].version == version) {
+        way = at.hand;
+        at.hand = 1 - at.hand;
+        if (at.referenced[way]) {
+            at.referenced[way] = false;
+            return;
+        }
+    }
+    at.way[way].pos = pos;
+    at.way[way].version = version;
+    at.way[way].hash = hash;
+    at.referenced[way] = false;
+}
+
+#endif
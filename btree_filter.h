@@ -0,0 +1,167 @@
+/**
+ * Approximate membership filters for btrees.
+ *
+ * A btree_filter answers "certainly absent" or "maybe present" for an
+ * element, from a few bits per element and a single cache line per
+ * query.  It is a blocked Bloom filter: the element's hash picks one
+ * 512-bit block, and all of the element's bits are set (and tested)
+ * inside that block.  That costs a little accuracy over a classic
+ * Bloom filter for the same memory, in exchange for one cache miss per
+ * query instead of one per bit.
+ *
+ * Filters only ever gain bits, so a filter for a set also answers
+ * correctly for any subset of it.
+ */
+
+#ifndef BTREE_FILTER_H
+#define BTREE_FILTER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+/**
+ * The hash btree filters use: std::hash<T> wherever it exists.
+ * Specialise it for element types without a std::hash; for those that
+ * have neither, available is false and filters are never built.
+ */
+template <typename T, typename = void>
+struct btree_hash {
+	static const bool available = false;
+	std::size_t operator()(const T&) const { return 0; }
+};
+
+template <typename T>
+struct btree_hash<T, decltype(void(std::hash<T>()(std::declval<const T&>())))> {
+	static const bool available = true;
+	std::size_t operator()(const T& elem) const { return std::hash<T>()(elem); }
+};
+
+template <typename T>
+class btree_filter {
+ public:
+  /**
+   * Constructs a disabled filter, which answers "maybe" to everything.
+   */
+  btree_filter() {}
+
+  /**
+   * Sizes the filter for expected elements at the given false-positive
+   * rate and clears it.  The rate only holds while no more than
+   * expected elements have been added.
+   *
+   * @param expected the number of elements to size the filter for.
+   * @param false_positive_rate the targeted fraction of absent elements
+   *        answered with "maybe"; 0 disables the filter.
+   */
+  void reset(std::size_t expected, double false_positive_rate);
+
+  bool enabled() const { return !words.empty(); }
+  void clear() { std::fill(words.begin(), words.end(), 0); added = 0; }
+
+  void add(const T& elem);
+  bool may_contain(const T& elem) const;
+
+  /**
+   * Adds every element of other, which must have been sized the same.
+   * The two may share elements (copies of one filter always do), so the
+   * count of elements added becomes the larger of the two, not their sum.
+   *
+   * @return false, adding nothing, if the two are sized differently.
+   */
+  bool merge(const btree_filter<T>& other);
+
+  /**
+   * Whether as many elements have been added as the filter was sized for.
+   */
+  bool full() const { return added >= expected; }
+
+  std::size_t capacity() const { return expected; }
+  double rate() const { return false_positive_rate; }
+  std::size_t bytes() const { return words.size() * sizeof(std::uint64_t); }
+
+private:
+	static const std::size_t block_words = 8;
+
+	// a 64-bit finalizer, since std::hash is often the identity
+	static std::uint64_t mix(std::uint64_t h) {
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ULL;
+		h ^= h >> 33;
+		return h;
+	}
+
+	// the first word of the block holding the bits of the element hashed to h
+	std::size_t block_of(std::uint64_t h) const {
+		return ((h >> 32) * blocks >> 32) * block_words;
+	}
+
+	std::vector<std::uint64_t> words;
+	std::size_t blocks = 0;
+	unsigned hashes = 0;
+	std::size_t expected = 0;
+	std::size_t added = 0;
+	double false_positive_rate = 0;
+};
+
+template <typename T>
+void btree_filter<T>::reset(std::size_t expected_arg, double false_positive_rate_arg) {
+    words.clear();
+    blocks = 0;
+    added = 0;
+    expected = expected_arg;
+    false_positive_rate = false_positive_rate_arg;
+    if (!btree_hash<T>::available || false_positive_rate <= 0 || false_positive_rate >= 1) return;
+    // the textbook optimum: -ln(p) / ln(2)^2 bits and ln(2) bits' worth
+    // of hashes per element
+    double bits_per_element = -std::log(false_positive_rate) / (std::log(2.0) * std::log(2.0));
+    hashes = static_cast<unsigned>(std::max(1.0, std::min(16.0, std::round(bits_per_element * std::log(2.0)))));
+    double bits = std::max<double>(1, expected) * bits_per_element;
+    blocks = std::max<std::size_t>(1, static_cast<std::size_t>(std::ceil(bits / (64 * block_words))));
+    words.assign(blocks * block_words, 0);
+}
+
+template <typename T>
+void btree_filter<T>::add(const T& elem) {
+    if (!enabled()) return;
+    std::uint64_t h = mix(btree_hash<T>()(elem));
+    std::uint64_t* block = words.data() + block_of(h);
+    // the bit positions step by an odd stride, so they do not repeat
+    std::uint32_t bit = static_cast<std::uint32_t>(h);
+    std::uint32_t step = static_cast<std::uint32_t>(mix(h) >> 32) | 1;
+    for (unsigned i = 0; i < hashes; ++i, bit += step) {
+        std::uint32_t pos = bit & (64 * block_words - 1);
+        block[pos / 64] |= std::uint64_t(1) << (pos % 64);
+    }
+    added++;
+}
+
+template <typename T>
+bool btree_filter<T>::may_contain(const T& elem) const {
+    if (!enabled()) return true;
+    std::uint64_t h = mix(btree_hash<T>()(elem));
+    const std::uint64_t* block = words.data() + block_of(h);
+    std::uint32_t bit = static_cast<std::uint32_t>(h);
+    std::uint32_t step = static_cast<std::uint32_t>(mix(h) >> 32) | 1;
+    for (unsigned i = 0; i < hashes; ++i, bit += step) {
+        std::uint32_t pos = bit & (64 * block_words - 1);
+        if ((block[pos / 64] & (std::uint64_t(1) << (pos % 64))) == 0) return false;
+    }
+    return true;
+}
+
+template <typename T>
+bool btree_filter<T>::merge(const btree_filter<T>& other) {
+    if (words.size() != other.words.size() || hashes != other.hashes) return false;
+    for (std::size_t i = 0; i < words.size(); ++i) words[i] |= other.words[i];
+    added = std::max(added, other.added);
+    return true;
+}
+
+#endif
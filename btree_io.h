@@ -0,0 +1,123 @@
+/**
+ * Binary snapshots of btrees.
+ *
+ * btree::save() writes a small header followed by every element in
+ * ascending order, and btree::load() reads that back and builds the
+ * nodes bottom-up.  How elements are encoded is up to btree_io<T>:
+ * trivially copyable types are written as their raw bytes, a whole
+ * block at a time, and std::string as a length followed by its
+ * characters.  Specialise btree_io for any other element type to make
+ * it saveable.
+ *
+ * Snapshots are in the writing machine's byte order and layout; they
+ * are for restoring on the same platform, not for exchange.
+ */
+
+#ifndef BTREE_IO_H
+#define BTREE_IO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <type_traits>
+
+/**
+ * Writes and reads runs of elements.  A specialisation provides
+ *
+ *   static const bool available = true;
+ *   static void write(std::ostream& os, const T* first, std::size_t count);
+ *   static bool read(std::istream& is, T* first, std::size_t count);
+ *
+ * where read fills count default-constructed elements and returns false
+ * if the stream ran out or held something that is not an element.
+ */
+template <typename T, typename = void>
+struct btree_io {
+	static const bool available = false;
+};
+
+template <typename T>
+struct btree_io<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type> {
+	static const bool available = true;
+	static void write(std::ostream& os, const T* first, std::size_t count) {
+		os.write(reinterpret_cast<const char*>(first), count * sizeof(T));
+	}
+	static bool read(std::istream& is, T* first, std::size_t count) {
+		is.read(reinterpret_cast<char*>(first), count * sizeof(T));
+		return static_cast<std::size_t>(is.gcount()) == count * sizeof(T);
+	}
+};
+
+template <>
+struct btree_io<std::string> {
+	static const bool available = true;
+	static void write(std::ostream& os, const std::string* first, std::size_t count) {
+		for (std::size_t i = 0; i < count; ++i) {
+			std::uint64_t length = first[i].size();
+			os.write(reinterpret_cast<const char*>(&length), sizeof(length));
+			os.write(first[i].data(), length);
+		}
+	}
+	static bool read(std::istream& is, std::string* first, std::size_t count) {
+		for (std::size_t i = 0; i < count; ++i) {
+			std::uint64_t length = 0;
+			if (!is.read(reinterpret_cast<char*>(&length), sizeof(length))) return false;
+			// grown as the characters arrive, so a corrupt length cannot
+			// allocate more than the stream holds
+			first[i].clear();
+			char chunk[4096];
+			while (length > 0) {
+				std::size_t part = length < sizeof(chunk) ? static_cast<std::size_t>(length) : sizeof(chunk);
+				if (!is.read(chunk, part)) return false;
+				first[i].append(chunk, part);
+				length -= part;
+			}
+		}
+		return true;
+	}
+};
+
+/**
+ * The framing every header shares, the snapshot's below and the trace's
+ * (see btree_trace.h): a magic string of magic_bytes, which also carries
+ * the format version, then a fixed run of 64-bit fields.
+ */
+struct btree_header_io {
+	static const std::size_t magic_bytes = 8;
+
+	static void write(std::ostream& os, const char* magic, std::initializer_list<const std::uint64_t*> fields) {
+		os.write(magic, magic_bytes);
+		for (const std::uint64_t* field : fields) os.write(reinterpret_cast<const char*>(field), sizeof(*field));
+	}
+
+	// false, setting failbit, unless a whole header starting with magic was read
+	static bool read(std::istream& is, const char* magic, std::initializer_list<std::uint64_t*> fields) {
+		char seen[magic_bytes];
+		is.read(seen, magic_bytes);
+		for (std::uint64_t* field : fields) is.read(reinterpret_cast<char*>(field), sizeof(*field));
+		if (is && std::memcmp(seen, magic, magic_bytes) == 0) return true;
+		is.setstate(std::ios::failbit);
+		return false;
+	}
+};
+
+/**
+ * The header in front of the elements: the magic, sizeof(T) as a check
+ * that the reader has the same element type in mind, and the number of
+ * elements.
+ */
+struct btree_snapshot_header {
+	std::uint64_t element_size = 0;
+	std::uint64_t count = 0;
+
+	static const char* magic() { return "btree\0\0\1"; }
+
+	void write(std::ostream& os) const { btree_header_io::write(os, magic(), {&element_size, &count}); }
+	bool read(std::istream& is) { return btree_header_io::read(is, magic(), {&element_size, &count}); }
+};
+
+#endif
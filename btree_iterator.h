@@ -2,11 +2,33 @@
 #define BTREE_ITERATOR_H
 
 #include <iterator>
+#include <memory>
+#if defined(BTREE_CHECKED_ITERATORS)
+#include <cassert>
+#endif
+
+#include "btree_ownership.h"
+
+// summary policy used when a btree is not given a monoid, see btree_summary.h
+struct btree_no_summary;
+
+template <typename T, typename Monoid = btree_no_summary, typename Ownership = btree_default_ownership> class btree;
+template <typename T, typename Monoid = btree_no_summary, typename Ownership = btree_default_ownership> class btree_iterator;
+template <typename T, typename Monoid = btree_no_summary, typename Ownership = btree_default_ownership> class const_btree_iterator;
 
-template <typename T> class btree;
-template <typename T> class const_btree_iterator;
+/**
+ * Both iterator flavours are a plain node pointer and an index into it,
+ * so copying, comparing and stepping one never touches the heap or a
+ * reference count; a null node stands for the inline buffer, or for
+ * end() when the index is the btree's end_index.  Like any container's,
+ * they dangle once their node is gone.  Building with
+ * BTREE_CHECKED_ITERATORS defined (for debug builds) makes each also
+ * hold a weak reference to its node and assert that it is still alive,
+ * and in range, whenever it is used; with btree_raw_nodes there is no
+ * such thing as a weak reference, and only the range is checked.
+ */
 
-template <typename T>
+template <typename T, typename Monoid, typename Ownership>
 class btree_iterator {
 public:
 	typedef std::ptrdiff_t            difference_type;
@@ -14,7 +36,8 @@ public:
 	typedef T                         value_type;
 	typedef T*                        pointer;
 	typedef T&                        reference;
-	friend class const_btree_iterator<T>;
+	friend class const_btree_iterator<T, Monoid, Ownership>;
+	friend class btree<T, Monoid, Ownership>;
 
 	reference operator*() const;
 	pointer operator->() const{ return &(operator*()); }
@@ -22,25 +45,31 @@ public:
 	btree_iterator operator++(int);
 	btree_iterator& operator--();
 	btree_iterator operator--(int);
-	btree_iterator& operator=(const btree_iterator& rhs);
 	bool operator==(const btree_iterator& other) const;
 	bool operator!=(const btree_iterator& other) const{ return !operator==(other); }
+	difference_type operator-(const btree_iterator& rhs) const{ return bt->distance(rhs, *this); }
 
 	//constructor
-	btree_iterator(std::shared_ptr<typename btree<T>::Node> node = std::make_shared<btree<T>::Node>(), 
-		size_t idx = 0, const btree<T>* btr = nullptr): 
-		pointee{node},
+	btree_iterator(typename btree<T, Monoid, Ownership>::Node* node_arg = nullptr,
+		std::size_t idx = 0, const btree<T, Monoid, Ownership>* btr = nullptr):
+		node{node_arg},
 		index{idx},
-		bt{btr} {};
+		bt{btr} { track(); }
 
 
 private: 
-	std::weak_ptr<typename btree<T>::Node> pointee;
-	size_t index;
-	const btree<T> *bt;
+	void check() const;
+	void track();
+
+	typename btree<T, Monoid, Ownership>::Node* node;
+	std::size_t index;
+	const btree<T, Monoid, Ownership> *bt;
+#if defined(BTREE_CHECKED_ITERATORS)
+	typename btree<T, Monoid, Ownership>::node_ref guard;
+#endif
 };
 
-template <typename T>
+template <typename T, typename Monoid, typename Ownership>
 class const_btree_iterator {
 public:
 	typedef std::ptrdiff_t            difference_type;
@@ -48,7 +77,8 @@ public:
 	typedef T                         value_type;
 	typedef const T*                        pointer;
 	typedef const T&                        reference;
-	friend class btree_iterator<T>;
+	friend class btree_iterator<T, Monoid, Ownership>;
+	friend class btree<T, Monoid, Ownership>;
 
 	reference operator*() const;
 	pointer operator->() const{ return &(operator*()); }
@@ -58,23 +88,34 @@ public:
 	const_btree_iterator operator--(int);
 	bool operator==(const const_btree_iterator& other) const;
 	bool operator!=(const const_btree_iterator& other) const{ return !operator==(other); }
+	difference_type operator-(const const_btree_iterator& rhs) const{ return bt->distance(rhs, *this); }
 
 	//constructor
-	const_btree_iterator(std::shared_ptr<typename btree<T>::Node> node = std::make_shared<btree<T>::Node> (), 
-		size_t idx = 0, const btree<T>* btr = nullptr): 
-		pointee{node},
+	const_btree_iterator(typename btree<T, Monoid, Ownership>::Node* node_arg = nullptr,
+		std::size_t idx = 0, const btree<T, Monoid, Ownership>* btr = nullptr):
+		node{node_arg},
 		index{idx},
-		bt{btr} {};
+		bt{btr} { track(); }
 
-	const_btree_iterator(const btree_iterator<T>& rhs):
-		pointee{rhs.pointee.lock()},
+	const_btree_iterator(const btree_iterator<T, Monoid, Ownership>& rhs):
+		node{rhs.node},
 		index{rhs.index},
-		bt{rhs.bt} {};
+		bt{rhs.bt}
+#if defined(BTREE_CHECKED_ITERATORS)
+		, guard{rhs.guard}
+#endif
+		{}
 
 private: 
-	std::weak_ptr<typename btree<T>::Node> pointee;
+	void check() const;
+	void track();
+
+	typename btree<T, Monoid, Ownership>::Node* node;
 	std::size_t index;
-	const btree<T> *bt;
+	const btree<T, Monoid, Ownership> *bt;
+#if defined(BTREE_CHECKED_ITERATORS)
+	typename btree<T, Monoid, Ownership>::node_ref guard;
+#endif
 };
 
 /**
@@ -84,175 +125,141 @@ private:
 
 // iterator related interface stuff here; would be nice if you called your
 // iterator class btree_iterator (and possibly const_btree_iterator)
-template <typename T>
-typename btree_iterator<T>::reference btree_iterator<T>::operator*() const {
-	return pointee.lock()->element[index];
+
+// checked mode: the node must still be owned by the btree, and index must
+// name one of its elements, or the inline buffer's
+template <typename T, typename Monoid, typename Ownership>
+void btree_iterator<T, Monoid, Ownership>::check() const {
+#if defined(BTREE_CHECKED_ITERATORS)
+	assert(bt != nullptr);
+	assert(node == nullptr || !guard.expired());
+	assert(node == nullptr ? index < bt->btree_size : index < node->element.size());
+#endif
 }
 
-template <typename T>
-btree_iterator<T>& btree_iterator<T>::operator++() {
-	bt->search_count++;
-	if (pointee.lock()->children[index + 1] != nullptr) {
-		pointee.lock()->traverse_index++;
-		pointee = pointee.lock()->children[index + 1];
-		index = 0;
-	}else{
-		if (index == pointee.lock()->element.size() - 1) {
-			if (bt->search_count == bt->btree_size) {
-				while (!pointee.expired()) {
-					pointee.lock()->traverse_index = 0;
-					pointee = pointee.lock()->parent;
-					index = 0;
-				}
-			}else{
-				pointee.lock()->traverse_index = 0;
-				pointee = pointee.lock()->parent;
-				index = pointee.lock()->traverse_index;
-			}
-		}else{
-			pointee.lock()->traverse_index++;
-			index++;
-		}
-	}
+template <typename T, typename Monoid, typename Ownership>
+void btree_iterator<T, Monoid, Ownership>::track() {
+#if defined(BTREE_CHECKED_ITERATORS)
+	guard = bt != nullptr && node != nullptr ? bt->owning(node) : nullptr;
+#endif
+}
+
+template <typename T, typename Monoid, typename Ownership>
+typename btree_iterator<T, Monoid, Ownership>::reference btree_iterator<T, Monoid, Ownership>::operator*() const {
+	check();
+	if (node == nullptr) return bt->inline_data()[index];
+	return node->element[index];
+}
+
+template <typename T, typename Monoid, typename Ownership>
+btree_iterator<T, Monoid, Ownership>& btree_iterator<T, Monoid, Ownership>::operator++() {
+	check();
+	bt->step_forward(node, index);
+	track();
 	return *this;
 }
 
-template <typename T>
-btree_iterator<T> btree_iterator<T>::operator++(int) {
+template <typename T, typename Monoid, typename Ownership>
+btree_iterator<T, Monoid, Ownership> btree_iterator<T, Monoid, Ownership>::operator++(int) {
 	btree_iterator tmp = *this;
 	operator ++();
 	return tmp;
 }
 
-template <typename T>
-btree_iterator<T>& btree_iterator<T>::operator--() {
-	bt->search_count++;
-	if (pointee.lock()->children[index] != nullptr) {
-		pointee.lock()->traverse_index--;
-		pointee = pointee.lock()->children[index];
-		index = 0;
-	}else{
-		if (index == 0) {
-			if (bt->search_count == bt->btree_size) {
-				while (!pointee.expired()) {
-					pointee.lock()->traverse_index = pointee.lock()->element.size();
-					pointee = pointee.lock()->parent;
-				}
-				index = 0;
-			}else{
-				pointee.lock()->traverse_index = pointee.lock()->element.size();
-				pointee = pointee.lock()->parent;
-				index = pointee.lock()->traverse_index;
-			}
-		}else{
-			pointee.lock()->traverse_index -= 1;
-			index -= 1;
-		}
-	}
+template <typename T, typename Monoid, typename Ownership>
+btree_iterator<T, Monoid, Ownership>& btree_iterator<T, Monoid, Ownership>::operator--() {
+#if defined(BTREE_CHECKED_ITERATORS)
+	if (index != btree<T, Monoid, Ownership>::end_index) check();
+#endif
+	bt->step_backward(node, index);
+	track();
 	return *this;
 }
 
-template <typename T>
-btree_iterator<T> btree_iterator<T>::operator--(int) {
+template <typename T, typename Monoid, typename Ownership>
+btree_iterator<T, Monoid, Ownership> btree_iterator<T, Monoid, Ownership>::operator--(int) {
 	btree_iterator tmp = *this;
 	operator --();
 	return tmp;
 }
 
-template <typename T>
-btree_iterator<T>& btree_iterator<T>::operator=(const btree_iterator& rhs) {
-	if (this != &rhs){
-		pointee = rhs.pointee;
-		index = rhs.index;
-		bt = rhs.index;
-	}
-	return *this;
+template <typename T, typename Monoid, typename Ownership>
+bool btree_iterator<T, Monoid, Ownership>::operator==(const btree_iterator<T, Monoid, Ownership>& rhs) const {
+	return (bt == rhs.bt && node == rhs.node && index == rhs.index);
+}
+
+template <typename T, typename Monoid, typename Ownership>
+void const_btree_iterator<T, Monoid, Ownership>::check() const {
+#if defined(BTREE_CHECKED_ITERATORS)
+	assert(bt != nullptr);
+	assert(node == nullptr || !guard.expired());
+	assert(node == nullptr ? index < bt->btree_size : index < node->element.size());
+#endif
 }
 
-template <typename T>
-bool btree_iterator<T>::operator==(const btree_iterator<T>& rhs) const {
-	return (bt == rhs.bt && pointee.lock() == rhs.pointee.lock() && index == rhs.index);
+template <typename T, typename Monoid, typename Ownership>
+void const_btree_iterator<T, Monoid, Ownership>::track() {
+#if defined(BTREE_CHECKED_ITERATORS)
+	guard = bt != nullptr && node != nullptr ? bt->owning(node) : nullptr;
+#endif
 }
 
-template <typename T>
-typename const_btree_iterator<T>::reference const_btree_iterator<T>::operator*() const {
-	return pointee.lock()->element[index];
+template <typename T, typename Monoid, typename Ownership>
+typename const_btree_iterator<T, Monoid, Ownership>::reference const_btree_iterator<T, Monoid, Ownership>::operator*() const {
+	check();
+	if (node == nullptr) return bt->inline_data()[index];
+	return node->element[index];
 }
 
-template <typename T>
-const_btree_iterator<T>& const_btree_iterator<T>::operator++() {
-	bt->search_count++;
-	if (pointee.lock()->children[index + 1] != nullptr) {
-		pointee.lock()->traverse_index++;
-		pointee = pointee.lock()->children[index + 1];
-		index = 0;
-	}else{
-		if (index == pointee.lock()->element.size() - 1) {
-			if (bt->search_count == bt->btree_size) {
-				while (!pointee.expired()) {
-					pointee.lock()->traverse_index = 0;
-					pointee = pointee.lock()->parent;
-					index = 0;
-				}
-			}else{
-				pointee.lock()->traverse_index = 0;
-				pointee = pointee.lock()->parent;
-				index = pointee.lock()->traverse_index;
-			}
-		}else{
-			pointee.lock()->traverse_index++;
-			index++;
-		}
-	}
+template <typename T, typename Monoid, typename Ownership>
+const_btree_iterator<T, Monoid, Ownership>& const_btree_iterator<T, Monoid, Ownership>::operator++() {
+	check();
+	bt->step_forward(node, index);
+	track();
 	return *this;
 }
 
-template <typename T>
-const_btree_iterator<T> const_btree_iterator<T>::operator++(int) {
+template <typename T, typename Monoid, typename Ownership>
+const_btree_iterator<T, Monoid, Ownership> const_btree_iterator<T, Monoid, Ownership>::operator++(int) {
 	const_btree_iterator tmp = *this;
 	operator ++();
 	return tmp;
 }
 
-template <typename T>
-const_btree_iterator<T>& const_btree_iterator<T>::operator--() {
-	bt->search_count++;
-	if (pointee.lock()->children[index] != nullptr) {
-		pointee.lock()->traverse_index--;
-		pointee = pointee.lock()->children[index];
-		index = 0;
-	}else{
-		if (index == 0) {
-			if (bt->search_count == bt->btree_size) {
-				while (!pointee.expired()) {
-					pointee.lock()->traverse_index = pointee.lock()->element.size();
-					pointee = pointee.lock()->parent;
-					index = 0;
-				}
-			}else{
-				pointee.lock()->traverse_index = pointee.lock()->element.size();
-				pointee = pointee.lock()->parent;
-				index = pointee.lock()->traverse_index;
-			}
-		}else{
-			pointee.lock()->traverse_index--;
-			index--;
-		}
-	}
+template <typename T, typename Monoid, typename Ownership>
+const_btree_iterator<T, Monoid, Ownership>& const_btree_iterator<T, Monoid, Ownership>::operator--() {
+#if defined(BTREE_CHECKED_ITERATORS)
+	if (index != btree<T, Monoid, Ownership>::end_index) check();
+#endif
+	bt->step_backward(node, index);
+	track();
 	return *this;
 }
 
-template <typename T>
-const_btree_iterator<T> const_btree_iterator<T>::operator--(int) {
+template <typename T, typename Monoid, typename Ownership>
+const_btree_iterator<T, Monoid, Ownership> const_btree_iterator<T, Monoid, Ownership>::operator--(int) {
 	const_btree_iterator tmp = *this;
 	operator --();
 	return tmp;
 }
 
 
-template <typename T>
-bool const_btree_iterator<T>::operator==(const const_btree_iterator<T>& rhs) const {
-	return (bt == rhs.bt && pointee.lock() == rhs.pointee.lock() && index == rhs.index);
+template <typename T, typename Monoid, typename Ownership>
+bool const_btree_iterator<T, Monoid, Ownership>::operator==(const const_btree_iterator<T, Monoid, Ownership>& rhs) const {
+	return (bt == rhs.bt && node == rhs.node && index == rhs.index);
+}
+
+// Found by argument-dependent lookup, so an unqualified distance(first,
+// last), or one after using std::distance, takes logarithmic time where
+// std::distance would walk; last may come before first.
+template <typename T, typename Monoid, typename Ownership>
+std::ptrdiff_t distance(const btree_iterator<T, Monoid, Ownership>& first, const btree_iterator<T, Monoid, Ownership>& last) {
+	return last - first;
+}
+
+template <typename T, typename Monoid, typename Ownership>
+std::ptrdiff_t distance(const const_btree_iterator<T, Monoid, Ownership>& first, const const_btree_iterator<T, Monoid, Ownership>& last) {
+	return last - first;
 }
 
 #endif
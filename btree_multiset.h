@@ -0,0 +1,172 @@
+/**
+ * A btree_multiset holds any number of copies of each element, but
+ * stores every distinct element only once, alongside the number of
+ * times it was inserted.  Memory therefore grows with the number of
+ * distinct elements, not with the number of inserts.
+ *
+ * Iteration expands the copies logically: an element inserted three
+ * times is visited three times in a row.
+ */
+
+#ifndef BTREE_MULTISET_H
+#define BTREE_MULTISET_H
+
+#include <cstddef>
+#include <iterator>
+
+#include "btree.h"
+
+template <typename T> class btree_multiset;
+
+/**
+ * The (read-only) bidirectional iterator over a btree_multiset.  It
+ * pairs an iterator into the underlying btree of distinct elements
+ * with the number of the copy currently visited.
+ */
+template <typename T>
+class btree_multiset_iterator {
+public:
+	typedef std::ptrdiff_t            difference_type;
+	typedef std::bidirectional_iterator_tag iterator_category;
+	typedef T                         value_type;
+	typedef const T*                  pointer;
+	typedef const T&                  reference;
+	friend class btree_multiset<T>;
+
+	reference operator*() const { return (*inner).elem; }
+	pointer operator->() const{ return &(operator*()); }
+	btree_multiset_iterator& operator++();
+	btree_multiset_iterator operator++(int);
+	btree_multiset_iterator& operator--();
+	btree_multiset_iterator operator--(int);
+	bool operator==(const btree_multiset_iterator& other) const{ return inner == other.inner && copy == other.copy; }
+	bool operator!=(const btree_multiset_iterator& other) const{ return !operator==(other); }
+
+private:
+	typedef typename btree<typename btree_multiset<T>::entry>::const_iterator inner_iterator;
+
+	btree_multiset_iterator(inner_iterator pos, std::size_t copy_arg = 0):
+		inner{pos},
+		copy{copy_arg} {};
+
+	inner_iterator inner;
+	std::size_t copy;
+};
+
+template <typename T>
+class btree_multiset {
+ public:
+	friend class btree_multiset_iterator<T>;
+	typedef btree_multiset_iterator<T> const_iterator;
+	typedef const_iterator iterator;
+
+  /**
+   * Constructs an empty btree_multiset.
+   *
+   * @param maxNodeElems the maximum number of distinct elements
+   *        that can be stored in each B-Tree node; by default as many
+   *        (element, count) entries as fit in the default node size
+   */
+  btree_multiset(std::size_t maxNodeElems = btree<entry>::capacity_for(btree_node_bytes<entry>::value)): tree{maxNodeElems} {}
+
+  /**
+    * Adds one more copy of elem.  The first copy creates an entry in the
+    * underlying btree, later ones only bump that entry's count.
+    *
+    * @param elem the element to be inserted.
+    * @return an iterator positioned at the newly added copy.
+    */
+  iterator insert(const T& elem);
+
+  /**
+    * Returns the number of copies of elem, in time proportional to the
+    * height of the underlying btree.
+    *
+    * @param elem the client element we are trying to match.
+    */
+  std::size_t count(const T& elem) const;
+
+  /**
+    * Returns an iterator to the first copy of elem, or end() if
+    * there is none.
+    */
+  iterator find(const T& elem) const;
+
+  iterator begin() const { return iterator(tree.cbegin()); }
+  iterator end() const { return iterator(tree.cend()); }
+
+  /**
+    * size() counts every copy, distinct_size() every distinct element.
+    */
+  std::size_t size() const { return total_size; }
+  std::size_t distinct_size() const { return tree.size(); }
+  bool empty() const { return total_size == 0; }
+
+private:
+	// ordered and matched on elem alone, so each value has one entry
+	struct entry {
+		T elem;
+		std::size_t count;
+
+		bool operator<(const entry& rhs) const { return elem < rhs.elem; }
+		bool operator==(const entry& rhs) const { return elem == rhs.elem; }
+	};
+
+	btree<entry> tree;
+	std::size_t total_size = 0;
+};
+
+template <typename T>
+btree_multiset_iterator<T>& btree_multiset_iterator<T>::operator++() {
+	if (++copy == (*inner).count) {
+		++inner;
+		copy = 0;
+	}
+	return *this;
+}
+
+template <typename T>
+btree_multiset_iterator<T> btree_multiset_iterator<T>::operator++(int) {
+	btree_multiset_iterator tmp = *this;
+	operator ++();
+	return tmp;
+}
+
+template <typename T>
+btree_multiset_iterator<T>& btree_multiset_iterator<T>::operator--() {
+	if (copy == 0) {
+		--inner;
+		copy = (*inner).count - 1;
+	} else {
+		--copy;
+	}
+	return *this;
+}
+
+template <typename T>
+btree_multiset_iterator<T> btree_multiset_iterator<T>::operator--(int) {
+	btree_multiset_iterator tmp = *this;
+	operator --();
+	return tmp;
+}
+
+template <typename T>
+typename btree_multiset<T>::iterator btree_multiset<T>::insert(const T& elem) {
+    std::pair<typename btree<entry>::iterator, bool> result = tree.insert(entry{elem, 1});
+    if (!result.second) (*result.first).count++;
+    total_size++;
+    return iterator(result.first, (*result.first).count - 1);
+}
+
+template <typename T>
+std::size_t btree_multiset<T>::count(const T& elem) const {
+    typename btree<entry>::const_iterator pos = tree.find(entry{elem, 0});
+    return pos == tree.cend() ? 0 : (*pos).count;
+}
+
+template <typename T>
+typename btree_multiset<T>::iterator btree_multiset<T>::find(const T& elem) const {
+    return iterator(tree.find(entry{elem, 0}));
+}
+
+#endif
@@ -0,0 +1,103 @@
+/**
+ * Ownership policies for btree nodes.
+ *
+ * A btree's third template argument decides how its nodes own each
+ * other.  btree_shared_nodes, the default, links them with shared_ptr
+ * and their parents with weak_ptr: every node lives exactly as long as
+ * something refers to it, which makes mistakes in the structural code
+ * show up as leaks rather than dangling pointers, and lets checked
+ * iterators (BTREE_CHECKED_ITERATORS) notice a node that is gone.
+ * btree_raw_nodes links them with plain pointers, so walking, copying
+ * and re-linking a node pointer costs nothing beyond the pointer and
+ * child slots are half the size; the btree frees nodes itself wherever
+ * the shared ones would lose their last owner.
+ *
+ * A policy provides
+ *
+ *   template <typename Node> using owner = ...;     // child slots, root
+ *   template <typename Node> using observer = ...;  // parent, tail
+ *   template <typename Node, typename... Args> static owner<Node> make(Args&&...);
+ *   template <typename Node> static void release(const owner<Node>&);
+ *   static const bool manual;
+ *
+ * where release frees a single node that no slot refers to any more
+ * (children included only if manual is false, in which case it need do
+ * nothing at all), and both pointer types offer the shared_ptr /
+ * weak_ptr operations the btree uses: get, ->, *, reset, lock, expired
+ * and comparison with each other and with nullptr.
+ *
+ * Defining BTREE_RAW_NODES makes btree_raw_nodes the default instead.
+ */
+
+#ifndef BTREE_OWNERSHIP_H
+#define BTREE_OWNERSHIP_H
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+struct btree_shared_nodes {
+	template <typename Node> using owner = std::shared_ptr<Node>;
+	template <typename Node> using observer = std::weak_ptr<Node>;
+
+	template <typename Node, typename... Args>
+	static std::shared_ptr<Node> make(Args&&... args) { return std::make_shared<Node>(std::forward<Args>(args)...); }
+
+	// a node goes with its last owner
+	template <typename Node>
+	static void release(const std::shared_ptr<Node>&) {}
+
+	static const bool manual = false;
+};
+
+/**
+ * A non-owning node pointer with just enough of the shared_ptr and
+ * weak_ptr interfaces to stand in for both.
+ */
+template <typename Node>
+class btree_node_ptr {
+ public:
+  btree_node_ptr(std::nullptr_t = nullptr) {}
+  explicit btree_node_ptr(Node* node_arg): node{node_arg} {}
+
+  Node* get() const { return node; }
+  Node* operator->() const { return node; }
+  Node& operator*() const { return *node; }
+  explicit operator bool() const { return node != nullptr; }
+  void reset() { node = nullptr; }
+
+  // weak_ptr's side: a raw pointer cannot tell whether its node is gone
+  btree_node_ptr lock() const { return *this; }
+  bool expired() const { return false; }
+
+  bool operator==(const btree_node_ptr& rhs) const { return node == rhs.node; }
+  bool operator!=(const btree_node_ptr& rhs) const { return node != rhs.node; }
+  bool operator==(std::nullptr_t) const { return node == nullptr; }
+  bool operator!=(std::nullptr_t) const { return node != nullptr; }
+
+private:
+	Node* node = nullptr;
+};
+
+struct btree_raw_nodes {
+	template <typename Node> using owner = btree_node_ptr<Node>;
+	template <typename Node> using observer = btree_node_ptr<Node>;
+
+	template <typename Node, typename... Args>
+	static btree_node_ptr<Node> make(Args&&... args) {
+		return btree_node_ptr<Node>(new Node(std::forward<Args>(args)...));
+	}
+
+	template <typename Node>
+	static void release(const btree_node_ptr<Node>& node) { delete node.get(); }
+
+	static const bool manual = true;
+};
+
+#if defined(BTREE_RAW_NODES)
+typedef btree_raw_nodes btree_default_ownership;
+#else
+typedef btree_shared_nodes btree_default_ownership;
+#endif
+
+#endif
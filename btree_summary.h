@@ -0,0 +1,76 @@
+/**
+ * Summary policies (monoids) for augmented btrees.
+ *
+ * A btree<T, Monoid> keeps, in every node, the combination of the
+ * values extracted from all the elements of that node's subtree, in
+ * sorted order.  btree<T, Monoid>::aggregate(lo, hi) can then fold a
+ * whole key range by visiting two root-to-leaf paths instead of every
+ * element in the range.
+ *
+ * A monoid is any default constructible type providing
+ *
+ *   typedef ... value_type;
+ *   value_type identity() const;
+ *   value_type extract(const T& elem) const;
+ *   value_type combine(const value_type& lhs, const value_type& rhs) const;
+ *
+ * where combine is associative and identity is its neutral element.
+ * combine need not be commutative: its arguments always come in
+ * key order.
+ */
+
+#ifndef BTREE_SUMMARY_H
+#define BTREE_SUMMARY_H
+
+#include <limits>
+#include <algorithm>
+
+/**
+ * The default policy: nothing is summarised and no space is spent.
+ */
+struct btree_no_summary {
+	struct value_type {};
+
+	value_type identity() const { return value_type{}; }
+	template <typename T>
+	value_type extract(const T&) const { return value_type{}; }
+	value_type combine(const value_type&, const value_type&) const { return value_type{}; }
+};
+
+/**
+ * Sum of the elements, accumulated in V (which defaults to T).
+ */
+template <typename T, typename V = T>
+struct btree_sum {
+	typedef V value_type;
+
+	value_type identity() const { return value_type{}; }
+	value_type extract(const T& elem) const { return static_cast<value_type>(elem); }
+	value_type combine(const value_type& lhs, const value_type& rhs) const { return lhs + rhs; }
+};
+
+/**
+ * Smallest element; the identity is the largest representable T.
+ */
+template <typename T>
+struct btree_min {
+	typedef T value_type;
+
+	value_type identity() const { return std::numeric_limits<T>::max(); }
+	value_type extract(const T& elem) const { return elem; }
+	value_type combine(const value_type& lhs, const value_type& rhs) const { return std::min(lhs, rhs); }
+};
+
+/**
+ * Largest element; the identity is the lowest representable T.
+ */
+template <typename T>
+struct btree_max {
+	typedef T value_type;
+
+	value_type identity() const { return std::numeric_limits<T>::lowest(); }
+	value_type extract(const T& elem) const { return elem; }
+	value_type combine(const value_type& lhs, const value_type& rhs) const { return std::max(lhs, rhs); }
+};
+
+#endif
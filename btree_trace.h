@@ -0,0 +1,176 @@
+/**
+ * Workload traces for btrees.
+ *
+ * A btree_recorder attached to a btree (see btree::set_recorder) logs
+ * each insert, find, contains, erase and start of an in-order walk,
+ * with the time it arrived, to a binary stream.  A btree_trace_reader
+ * reads the events back; tools/btree_replay runs them against any
+ * tree configuration and reports latency percentiles per operation.
+ *
+ * Each event is one byte for the operation, the nanoseconds since the
+ * previous event as a base-128 varint, and then the element, encoded by
+ * btree_io<T> (see btree_io.h); walks carry no element, and neither
+ * does any event for a T that btree_io cannot encode.  A walk records
+ * only where it started (iterate from begin(), reverse_iterate from
+ * rbegin()): the iterators are plain positions that never report back,
+ * so how far it went is not known, and a replay has to choose.  A trace
+ * only records what was asked of the tree, not what was in it to begin
+ * with, so save() a snapshot just before attaching the recorder to
+ * replay against the same contents.
+ */
+
+#ifndef BTREE_TRACE_H
+#define BTREE_TRACE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <type_traits>
+
+#include "btree_io.h"
+
+enum class btree_op : unsigned char { insert, find, contains, erase, iterate, reverse_iterate };
+
+static const std::size_t btree_op_count = 6;
+
+// the walks, which carry no element
+inline bool btree_op_walks(btree_op op) { return op == btree_op::iterate || op == btree_op::reverse_iterate; }
+
+inline const char* btree_op_name(btree_op op) {
+	static const char* const names[btree_op_count] = {"insert", "find", "contains", "erase", "iterate", "reverse_iterate"};
+	return names[static_cast<std::size_t>(op)];
+}
+
+// the header of a trace: its own magic, framed as btree_header_io
+// frames a snapshot's, and sizeof(T)
+struct btree_trace_header {
+	std::uint64_t element_size = 0;
+
+	static const char* magic() { return "btrace\0\1"; }
+
+	void write(std::ostream& os) const { btree_header_io::write(os, magic(), {&element_size}); }
+	bool read(std::istream& is) { return btree_header_io::read(is, magic(), {&element_size}); }
+};
+
+template <typename T>
+class btree_recorder {
+ public:
+  /**
+   * Starts a trace on os, which should be opened in binary mode and
+   * outlive the recorder; time is counted from here.
+   */
+  explicit btree_recorder(std::ostream& os);
+  ~btree_recorder() { out.flush(); }
+
+  btree_recorder(const btree_recorder&) = delete;
+  btree_recorder& operator=(const btree_recorder&) = delete;
+
+  /**
+   * Appends an event.
+   *
+   * @param elem the element operated on; null for the walks.
+   */
+  void record(btree_op op, const T* elem);
+
+  std::size_t events() const { return event_count; }
+
+private:
+	typedef std::chrono::steady_clock clock_type;
+
+	void write(const T& elem, std::true_type) { btree_io<T>::write(out, &elem, 1); }
+	void write(const T&, std::false_type) {}
+
+	std::ostream& out;
+	clock_type::time_point last;
+	std::size_t event_count = 0;
+};
+
+template <typename T>
+struct btree_trace_event {
+	btree_op op = btree_op::find;
+	// nanoseconds since the recorder started
+	std::uint64_t time = 0;
+	// unset for the walks
+	T elem{};
+};
+
+template <typename T>
+class btree_trace_reader {
+ public:
+  /**
+   * Reads the header of a trace from is; good() tells whether it was
+   * one for elements of T's size.
+   */
+  explicit btree_trace_reader(std::istream& is);
+
+  bool good() const { return valid; }
+
+  /**
+   * Reads the next event into event.
+   *
+   * @return false at the end of the trace, or at anything that is not
+   *         a whole event.
+   */
+  bool next(btree_trace_event<T>& event);
+
+private:
+	bool read(T& elem, std::true_type) { return btree_io<T>::read(in, &elem, 1); }
+	bool read(T&, std::false_type) { return true; }
+
+	std::istream& in;
+	std::uint64_t time = 0;
+	bool valid;
+};
+
+template <typename T>
+btree_recorder<T>::btree_recorder(std::ostream& os): out(os), last(clock_type::now()) {
+    btree_trace_header header;
+    header.element_size = sizeof(T);
+    header.write(out);
+}
+
+template <typename T>
+void btree_recorder<T>::record(btree_op op, const T* elem) {
+    clock_type::time_point now = clock_type::now();
+    std::uint64_t delta = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+    last = now;
+    char head[1 + 10];
+    std::size_t length = 0;
+    head[length++] = static_cast<char>(op);
+    do {
+        unsigned char low = delta & 0x7f;
+        delta >>= 7;
+        head[length++] = static_cast<char>(delta != 0 ? low | 0x80 : low);
+    } while (delta != 0);
+    out.write(head, length);
+    if (elem != nullptr) write(*elem, std::integral_constant<bool, btree_io<T>::available>());
+    event_count++;
+}
+
+template <typename T>
+btree_trace_reader<T>::btree_trace_reader(std::istream& is): in(is) {
+    btree_trace_header header;
+    valid = header.read(in) && header.element_size == sizeof(T);
+}
+
+template <typename T>
+bool btree_trace_reader<T>::next(btree_trace_event<T>& event) {
+    if (!valid) return false;
+    char op;
+    if (!in.get(op) || static_cast<unsigned char>(op) >= btree_op_count) return false;
+    event.op = static_cast<btree_op>(op);
+    std::uint64_t delta = 0;
+    for (unsigned shift = 0; ; shift += 7) {
+        char byte;
+        if (shift >= 64 || !in.get(byte)) return false;
+        delta |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    time += delta;
+    event.time = time;
+    return btree_op_walks(event.op) || read(event.elem, std::integral_constant<bool, btree_io<T>::available>());
+}
+
+#endif
@@ -0,0 +1,222 @@
+/**
+ * A frozen_btree is the read-only form of a btree, for data that is
+ * loaded once and then only searched.  All the elements sit in a single
+ * array in Eytzinger (breadth-first) order: the root of an implicit
+ * binary search tree in slot 1, and the children of slot k in slots 2k
+ * and 2k + 1.  A search therefore reads one contiguous array, its first
+ * levels share a few cache lines, and the descent needs no branch on
+ * the comparison, so a lookup's later levels can be prefetched while
+ * the earlier ones are still being compared.
+ *
+ * Build one with btree<T, Monoid>::freeze(), or from any sorted range.
+ */
+
+#ifndef FROZEN_BTREE_H
+#define FROZEN_BTREE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <vector>
+
+#include "btree.h"
+
+template <typename T> class frozen_btree;
+
+/**
+ * The (read-only) bidirectional iterator over a frozen_btree, visiting
+ * the elements in ascending order.  It is just a slot of the array;
+ * slot 0 is end().
+ */
+template <typename T>
+class frozen_btree_iterator {
+public:
+	typedef std::ptrdiff_t            difference_type;
+	typedef std::bidirectional_iterator_tag iterator_category;
+	typedef T                         value_type;
+	typedef const T*                  pointer;
+	typedef const T&                  reference;
+	friend class frozen_btree<T>;
+
+	reference operator*() const { return tree->layout[slot]; }
+	pointer operator->() const{ return &(operator*()); }
+	frozen_btree_iterator& operator++() { slot = tree->successor(slot); return *this; }
+	frozen_btree_iterator operator++(int) { frozen_btree_iterator tmp = *this; operator ++(); return tmp; }
+	frozen_btree_iterator& operator--() { slot = tree->predecessor(slot); return *this; }
+	frozen_btree_iterator operator--(int) { frozen_btree_iterator tmp = *this; operator --(); return tmp; }
+	bool operator==(const frozen_btree_iterator& other) const{ return slot == other.slot; }
+	bool operator!=(const frozen_btree_iterator& other) const{ return !operator==(other); }
+
+private:
+	frozen_btree_iterator(const frozen_btree<T>* tree_arg, std::size_t slot_arg):
+		tree{tree_arg},
+		slot{slot_arg} {};
+
+	const frozen_btree<T>* tree;
+	std::size_t slot;
+};
+
+template <typename T>
+class frozen_btree {
+ public:
+	friend class frozen_btree_iterator<T>;
+	template <typename, typename, typename> friend class btree;
+	typedef frozen_btree_iterator<T> const_iterator;
+	typedef const_iterator iterator;
+	typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+	typedef const_reverse_iterator reverse_iterator;
+
+  /**
+   * Builds a frozen_btree from [first, last), which must already be
+   * strictly increasing, in linear time.
+   *
+   * @param first the start of the sorted input range.
+   * @param last one past the end of the sorted input range.
+   */
+  template <typename ForwardIt>
+  frozen_btree(ForwardIt first, ForwardIt last): frozen_btree(first, std::distance(first, last)) {}
+
+  frozen_btree(): frozen_btree(static_cast<const T*>(nullptr), 0) {}
+
+  std::size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+
+  iterator begin() const { return iterator(this, count == 0 ? 0 : leftmost(1)); }
+  iterator end() const { return iterator(this, 0); }
+  reverse_iterator rbegin() const { return reverse_iterator(end()); }
+  reverse_iterator rend() const { return reverse_iterator(begin()); }
+
+  /**
+    * Returns an iterator to the first element not less than elem, or
+    * end().  The elements x with lo <= x < hi are the range
+    * [lower_bound(lo), lower_bound(hi)).
+    *
+    * @param elem the client element to search for.
+    */
+  iterator lower_bound(const T& elem) const { return iterator(this, search(elem)); }
+
+  /**
+    * Returns an iterator to the first element greater than elem, or end().
+    */
+  iterator upper_bound(const T& elem) const;
+
+  /**
+    * Returns an iterator to the matching element, or end().
+    */
+  iterator find(const T& elem) const;
+  bool contains(const T& elem) const { return find(elem) != end(); }
+
+private:
+	template <typename ForwardIt>
+	frozen_btree(ForwardIt first, std::size_t count_arg);
+
+	// the slot of the first element not less than elem, 0 if there is none
+	std::size_t search(const T& elem) const;
+	// lays the sorted input out in order over the subtree rooted at slot
+	template <typename ForwardIt>
+	void fill(ForwardIt& next, std::size_t slot);
+
+	std::size_t leftmost(std::size_t slot) const {
+		while (2 * slot <= count) slot = 2 * slot;
+		return slot;
+	}
+	std::size_t rightmost(std::size_t slot) const {
+		while (2 * slot + 1 <= count) slot = 2 * slot + 1;
+		return slot;
+	}
+	// in-order neighbours in the implicit tree; 0 stands for end()
+	std::size_t successor(std::size_t slot) const;
+	std::size_t predecessor(std::size_t slot) const;
+
+	// the number of trailing 1 bits of x
+	static std::size_t trailing_ones(std::size_t x) {
+#if defined(__GNUC__)
+		return ~x == 0 ? sizeof(x) * 8 : __builtin_ctzll(~static_cast<unsigned long long>(x));
+#else
+		std::size_t ones = 0;
+		for (; x & 1; x >>= 1) ones++;
+		return ones;
+#endif
+	}
+
+	// slot 0 only pads the array so that the root is slot 1
+	std::vector<T> layout;
+	std::size_t count;
+};
+
+template <typename T>
+template <typename ForwardIt>
+frozen_btree<T>::frozen_btree(ForwardIt first, std::size_t count_arg): count{count_arg} {
+    if (count == 0) return;
+    layout.assign(count + 1, *first);
+    fill(first, 1);
+}
+
+template <typename T>
+template <typename ForwardIt>
+void frozen_btree<T>::fill(ForwardIt& next, std::size_t slot) {
+    if (slot > count) return;
+    fill(next, 2 * slot);
+    layout[slot] = *next;
+    ++next;
+    fill(next, 2 * slot + 1);
+}
+
+template <typename T>
+std::size_t frozen_btree<T>::search(const T& elem) const {
+    // Going right at every level where the slot is less than elem leaves,
+    // in the bits of slot, the path taken; the answer is where the path
+    // last went left, found by dropping the trailing right turns.  A
+    // cache line holds the slots of several levels down, so the line
+    // that many levels ahead is prefetched.
+    const std::size_t ahead = sizeof(T) < 64 ? 64 / sizeof(T) : 1;
+    const T* base = layout.data();
+    std::size_t slot = 1;
+    while (slot <= count) {
+        btree_prefetch(base + std::min(slot * ahead, count));
+        slot = 2 * slot + (base[slot] < elem);
+    }
+    return slot >> (trailing_ones(slot) + 1);
+}
+
+template <typename T>
+typename frozen_btree<T>::iterator frozen_btree<T>::upper_bound(const T& elem) const {
+    std::size_t slot = search(elem);
+    if (slot != 0 && layout[slot] == elem) slot = successor(slot);
+    return iterator(this, slot);
+}
+
+template <typename T>
+typename frozen_btree<T>::iterator frozen_btree<T>::find(const T& elem) const {
+    std::size_t slot = search(elem);
+    if (slot != 0 && layout[slot] == elem) return iterator(this, slot);
+    return end();
+}
+
+template <typename T>
+std::size_t frozen_btree<T>::successor(std::size_t slot) const {
+    if (slot == 0) return 0;
+    if (2 * slot + 1 <= count) return leftmost(2 * slot + 1);
+    // climb while coming from a right child, then once more
+    return slot >> (trailing_ones(slot) + 1);
+}
+
+template <typename T>
+std::size_t frozen_btree<T>::predecessor(std::size_t slot) const {
+    if (slot == 0) return count == 0 ? 0 : rightmost(1);
+    if (2 * slot <= count) return rightmost(2 * slot);
+    while (slot > 1 && slot % 2 == 0) slot /= 2;
+    return slot / 2;
+}
+
+/**
+ * Defined here rather than in btree.h, so that only the users of
+ * freeze() pay for including frozen_btree.h.
+ */
+template <typename T, typename Monoid, typename Ownership>
+frozen_btree<T> btree<T, Monoid, Ownership>::freeze() const {
+    std::size_t count = size();
+    return frozen_btree<T>(const_iterator(leftmost()), count);
+}
+
+#endif
@@ -0,0 +1,498 @@
+/**
+ * A sharded_btree splits the key space into ranges and keeps each range
+ * in a btree of its own, guarded by its own mutex, so that writers to
+ * different ranges never wait for each other.  The split points come
+ * from a sample (partition()), or, without one, from the data itself:
+ * a shard that grows large is split at its median, and once every
+ * shard is in use, a shard holding twice its share hands its smaller
+ * neighbour half of the difference.  Both are cheap, since btree split and join
+ * only cut along one path.
+ *
+ * The shards and their bounds are published together as an immutable
+ * layout, replaced whole when a range changes, so finding a key's shard
+ * takes no lock and writes to no shared cache line.  Each shard carries a
+ * version, bumped whenever its range changes; a caller that picked a
+ * shard from an older layout sees the version differ once it holds the
+ * shard's mutex, and looks again.
+ *
+ * insert(), contains(), size() and the bulk operations may be called
+ * from any number of threads.  Iteration, which visits the shards in
+ * key order, must not run concurrently with writers.
+ */
+
+#ifndef SHARDED_BTREE_H
+#define SHARDED_BTREE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "btree.h"
+
+template <typename T> class sharded_btree;
+
+/**
+ * The (read-only) bidirectional iterator over a sharded_btree.  Shards
+ * hold disjoint, increasing ranges, so walking them one after another
+ * visits every element in order.
+ */
+template <typename T>
+class sharded_btree_iterator {
+public:
+	typedef std::ptrdiff_t            difference_type;
+	typedef std::bidirectional_iterator_tag iterator_category;
+	typedef T                         value_type;
+	typedef const T*                  pointer;
+	typedef const T&                  reference;
+	friend class sharded_btree<T>;
+
+	reference operator*() const { return *pos; }
+	pointer operator->() const{ return &(operator*()); }
+	sharded_btree_iterator& operator++();
+	sharded_btree_iterator operator++(int);
+	sharded_btree_iterator& operator--();
+	sharded_btree_iterator operator--(int);
+	bool operator==(const sharded_btree_iterator& other) const{ return shard == other.shard && pos == other.pos; }
+	bool operator!=(const sharded_btree_iterator& other) const{ return !operator==(other); }
+
+private:
+	typedef typename btree<T>::const_iterator inner_iterator;
+	typedef typename sharded_btree<T>::layout_type layout_type;
+
+	sharded_btree_iterator(const layout_type* layout_arg, std::size_t shard_arg, inner_iterator pos_arg):
+		layout{layout_arg},
+		shard{shard_arg},
+		pos{pos_arg} {};
+
+	// moves on to the first element of the next non-empty shard, if pos is
+	// at the end of its shard and there is a next one
+	void skip_empty();
+
+	const layout_type* layout;
+	std::size_t shard;
+	inner_iterator pos;
+};
+
+template <typename T>
+class sharded_btree {
+ public:
+	friend class sharded_btree_iterator<T>;
+	typedef sharded_btree_iterator<T> const_iterator;
+	typedef const_iterator iterator;
+
+  /**
+   * Constructs an empty sharded_btree, with a single shard.
+   *
+   * @param max_shards the most shards the key space is split into;
+   *        by default four per hardware thread
+   * @param maxNodeElems the node capacity of every shard's btree
+   */
+  explicit sharded_btree(std::size_t max_shards = 4 * std::max(1u, std::thread::hardware_concurrency()),
+      std::size_t maxNodeElems = btree<T>::capacity_for(btree_node_bytes<T>::value));
+
+  /**
+   * Redistributes the elements over max_shards ranges bounded by
+   * evenly spaced quantiles of a sample of the keys to come.
+   * Every element already present is kept.
+   *
+   * @param first the start of the sample, in any order.
+   * @param last one past the end of the sample.
+   */
+  template <typename InputIt>
+  void partition(InputIt first, InputIt last);
+
+  /**
+   * Inserts elem unless it is already present, locking only the shard
+   * whose range holds it.
+   *
+   * @return true if elem was inserted.
+   */
+  bool insert(const T& elem);
+  bool contains(const T& elem) const;
+
+  /**
+   * The sum of the shards' sizes.  While writers run, an element on its
+   * way between two shards may be counted in neither or in both.
+   */
+  std::size_t size() const;
+  bool empty() const { return size() == 0; }
+  std::size_t shard_count() const;
+  /**
+   * The bounds between the shards, in increasing order: shard i holds
+   * the elements from split_points()[i - 1] up to split_points()[i].
+   */
+  std::vector<T> split_points() const { return current.load(std::memory_order_acquire)->bounds; }
+
+  /**
+   * Inserts [first, last) using up to threads threads (by default one
+   * per hardware thread).  The input is first bucketed by shard, then
+   * each thread takes whole buckets and inserts each under a single
+   * lock, so no two threads share a lock.  What a rebalance leaves
+   * uninserted is bucketed again under the new bounds.
+   */
+  template <typename ForwardIt>
+  void insert_bulk(ForwardIt first, ForwardIt last, unsigned threads = 0);
+
+  /**
+   * Writes, for every key in [first, last) and in the same order,
+   * whether it is present, using up to threads threads.
+   */
+  template <typename RandomIt, typename OutputIt>
+  OutputIt contains_bulk(RandomIt first, RandomIt last, OutputIt out, unsigned threads = 0) const;
+
+  iterator begin() const;
+  iterator end() const;
+
+private:
+	struct shard {
+		shard(std::size_t capacity): tree{capacity} {}
+
+		mutable std::mutex lock;
+		btree<T> tree;
+		// tree.size(), kept for size() to read without the lock
+		std::atomic<std::size_t> count{0};
+		// bumped, under lock, whenever the shard's range changes
+		std::uint64_t version = 0;
+		// the size at which the shard is next considered for rebalancing
+		std::size_t check_at = min_split;
+	};
+
+	struct layout_type {
+		std::vector<shard*> shards;
+		// the version of each shard when the layout was published
+		std::vector<std::uint64_t> versions;
+		// shard i holds the elements x with bounds[i - 1] <= x < bounds[i]
+		std::vector<T> bounds;
+
+		std::size_t shard_of(const T& elem) const {
+			return std::upper_bound(bounds.begin(), bounds.end(), elem) - bounds.begin();
+		}
+	};
+
+	// shards are not split below this size, so small trees stay in one
+	static const std::size_t min_split = 4096;
+
+	// locks the shard holding elem in the current layout, and returns it
+	shard& lock_shard(const T& elem, std::unique_lock<std::mutex>& guard) const;
+	// splits the shard holding elem, or moves part of it to a neighbour,
+	// once it has grown enough
+	void rebalance(const T& elem);
+	// makes next the current layout; the caller holds resize, and the locks
+	// of every shard whose range changed
+	void publish(std::unique_ptr<layout_type> next);
+	static unsigned thread_count(unsigned threads, std::size_t work) {
+		if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+		return static_cast<unsigned>(std::min<std::size_t>(threads, std::max<std::size_t>(work, 1)));
+	}
+
+	std::atomic<const layout_type*> current{nullptr};
+	// held while shards or bounds change, by rebalance() and partition()
+	std::mutex resize;
+	// every shard and every layout ever published, freed only with the
+	// sharded_btree, so a reader holding an old layout never dangles
+	std::vector<std::unique_ptr<shard>> owned;
+	std::vector<std::unique_ptr<layout_type>> layouts;
+	std::size_t max_shards;
+	std::size_t node_capacity;
+};
+
+template <typename T>
+const std::size_t sharded_btree<T>::min_split;
+
+template <typename T>
+sharded_btree<T>::sharded_btree(std::size_t max_shards_arg, std::size_t maxNodeElems):
+    max_shards{std::max<std::size_t>(1, max_shards_arg)},
+    node_capacity{maxNodeElems} {
+    owned.emplace_back(new shard(node_capacity));
+    std::unique_ptr<layout_type> first(new layout_type);
+    first->shards.push_back(owned.back().get());
+    first->versions.push_back(0);
+    publish(std::move(first));
+}
+
+template <typename T>
+void sharded_btree<T>::publish(std::unique_ptr<layout_type> next) {
+    layouts.push_back(std::move(next));
+    current.store(layouts.back().get(), std::memory_order_release);
+}
+
+template <typename T>
+template <typename InputIt>
+void sharded_btree<T>::partition(InputIt first, InputIt last) {
+    std::vector<T> sample(first, last);
+    std::sort(sample.begin(), sample.end());
+    sample.erase(std::unique(sample.begin(), sample.end()), sample.end());
+
+    std::lock_guard<std::mutex> writer(resize);
+    const layout_type& seen = *current.load(std::memory_order_relaxed);
+    std::vector<std::unique_lock<std::mutex>> guards;
+    for (shard* part : seen.shards) guards.emplace_back(part->lock);
+    // gather everything into one btree, then cut it at the new bounds;
+    // the old shards are left empty, with versions no layout will match
+    btree<T> all(node_capacity);
+    for (shard* part : seen.shards) {
+        all = btree<T>::join(std::move(all), std::move(part->tree));
+        part->count.store(0, std::memory_order_relaxed);
+        part->version++;
+    }
+    std::unique_ptr<layout_type> next(new layout_type);
+    std::size_t ranges = std::min(max_shards, sample.size() + 1);
+    for (std::size_t i = 1; i < ranges; ++i) next->bounds.push_back(sample[i * sample.size() / ranges]);
+    next->bounds.erase(std::unique(next->bounds.begin(), next->bounds.end()), next->bounds.end());
+
+    std::vector<std::unique_ptr<shard>> parts(next->bounds.size() + 1);
+    for (std::size_t i = next->bounds.size() + 1; i-- > 0; ) {
+        parts[i].reset(new shard(node_capacity));
+        if (i > 0) parts[i]->tree = all.split(next->bounds[i - 1]);
+        else parts[i]->tree = std::move(all);
+        parts[i]->count.store(parts[i]->tree.size(), std::memory_order_relaxed);
+        parts[i]->check_at = std::max(min_split, parts[i]->tree.size() + parts[i]->tree.size() / 4);
+    }
+    for (std::unique_ptr<shard>& part : parts) {
+        next->shards.push_back(part.get());
+        next->versions.push_back(0);
+        owned.push_back(std::move(part));
+    }
+    publish(std::move(next));
+}
+
+template <typename T>
+typename sharded_btree<T>::shard& sharded_btree<T>::lock_shard(const T& elem, std::unique_lock<std::mutex>& guard) const {
+    while (true) {
+        const layout_type& seen = *current.load(std::memory_order_acquire);
+        std::size_t index = seen.shard_of(elem);
+        shard& part = *seen.shards[index];
+        guard = std::unique_lock<std::mutex>(part.lock);
+        // unchanged since seen was published, so its range there still holds
+        if (part.version == seen.versions[index]) return part;
+        guard.unlock();
+    }
+}
+
+template <typename T>
+bool sharded_btree<T>::insert(const T& elem) {
+    bool inserted;
+    bool crowded;
+    {
+        std::unique_lock<std::mutex> guard;
+        shard& part = lock_shard(elem, guard);
+        inserted = part.tree.insert(elem).second;
+        if (inserted) part.count.store(part.tree.size(), std::memory_order_relaxed);
+        crowded = part.tree.size() >= part.check_at;
+    }
+    if (crowded) rebalance(elem);
+    return inserted;
+}
+
+template <typename T>
+bool sharded_btree<T>::contains(const T& elem) const {
+    std::unique_lock<std::mutex> guard;
+    return lock_shard(elem, guard).tree.contains(elem);
+}
+
+template <typename T>
+std::size_t sharded_btree<T>::size() const {
+    std::size_t total = 0;
+    for (const shard* part : current.load(std::memory_order_acquire)->shards) {
+        total += part->count.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+template <typename T>
+std::size_t sharded_btree<T>::shard_count() const {
+    return current.load(std::memory_order_acquire)->shards.size();
+}
+
+template <typename T>
+void sharded_btree<T>::rebalance(const T& elem) {
+    std::lock_guard<std::mutex> writer(resize);
+    // only writers publish, so this is the current layout until we do
+    const layout_type& seen = *current.load(std::memory_order_relaxed);
+    std::size_t index = seen.shard_of(elem);
+    shard& big = *seen.shards[index];
+    std::unique_lock<std::mutex> big_guard(big.lock);
+    std::size_t size = big.tree.size();
+    if (size < big.check_at) return;
+    big.check_at = size + size / 4;
+    std::unique_ptr<layout_type> next(new layout_type(seen));
+
+    // while shards are left, any shard of min_split elements is split
+    if (seen.shards.size() < max_shards) {
+        T median = *big.tree.select(size / 2);
+        owned.emplace_back(new shard(node_capacity));
+        shard& upper = *owned.back();
+        upper.tree = big.tree.split(median);
+        upper.check_at = big.check_at = std::max(min_split, size / 2 + size / 8);
+        upper.count.store(upper.tree.size(), std::memory_order_relaxed);
+        big.count.store(big.tree.size(), std::memory_order_relaxed);
+        big.version++;
+        next->shards.insert(next->shards.begin() + index + 1, &upper);
+        next->versions.insert(next->versions.begin() + index + 1, upper.version);
+        next->versions[index] = big.version;
+        next->bounds.insert(next->bounds.begin() + index, median);
+        publish(std::move(next));
+        return;
+    }
+
+    // every shard is in use: one holding twice its share hands the
+    // smaller neighbour half the difference
+    std::size_t share = this->size() / max_shards;
+    if (size < 2 * share) return;
+    std::size_t left = index > 0 ? seen.shards[index - 1]->count.load(std::memory_order_relaxed) : size;
+    std::size_t right = index + 1 < seen.shards.size() ? seen.shards[index + 1]->count.load(std::memory_order_relaxed) : size;
+    std::size_t smaller = std::min(left, right);
+    std::size_t moved = size > smaller ? (size - smaller) / 2 : 0;
+    // not worth a split and a join
+    if (moved < size / 8) return;
+    std::size_t other = right <= left ? index + 1 : index - 1;
+    shard& neighbour = *seen.shards[other];
+    // two shard locks are taken left to right, as partition() takes them;
+    // big may have changed while unlocked, so the sizes are read again
+    std::unique_lock<std::mutex> neighbour_guard(neighbour.lock, std::defer_lock);
+    if (other < index) big_guard.unlock();
+    neighbour_guard.lock();
+    if (other < index) big_guard.lock();
+    size = big.tree.size();
+    moved = size > neighbour.tree.size() ? (size - neighbour.tree.size()) / 2 : 0;
+    if (moved == 0) return;
+    if (other > index) {
+        T cut = *big.tree.select(size - moved);
+        neighbour.tree = btree<T>::join(big.tree.split(cut), std::move(neighbour.tree));
+        next->bounds[index] = cut;
+    } else {
+        T cut = *big.tree.select(moved);
+        btree<T> upper = big.tree.split(cut);
+        neighbour.tree = btree<T>::join(std::move(neighbour.tree), std::move(big.tree));
+        big.tree = std::move(upper);
+        next->bounds[other] = cut;
+    }
+    big.count.store(big.tree.size(), std::memory_order_relaxed);
+    neighbour.count.store(neighbour.tree.size(), std::memory_order_relaxed);
+    next->versions[index] = ++big.version;
+    next->versions[other] = ++neighbour.version;
+    publish(std::move(next));
+}
+
+template <typename T>
+template <typename ForwardIt>
+void sharded_btree<T>::insert_bulk(ForwardIt first, ForwardIt last, unsigned threads) {
+    std::vector<T> pending(first, last);
+    while (!pending.empty()) {
+        const layout_type& seen = *current.load(std::memory_order_acquire);
+        std::vector<std::vector<T>> buckets(seen.shards.size());
+        for (const T& elem : pending) buckets[seen.shard_of(elem)].push_back(elem);
+        pending.clear();
+        std::mutex pending_lock;
+        std::atomic<std::size_t> next{0};
+        auto work = [&]() {
+            std::vector<T> rest;
+            for (std::size_t bucket; (bucket = next.fetch_add(1)) < buckets.size(); ) {
+                const std::vector<T>& elems = buckets[bucket];
+                if (elems.empty()) continue;
+                std::size_t done = 0;
+                bool crowded = false;
+                {
+                    shard& part = *seen.shards[bucket];
+                    std::lock_guard<std::mutex> guard(part.lock);
+                    // a bucket whose shard changed range goes round again
+                    // whole; one that crowds its shard stops there, so
+                    // the rebalance can move the bounds for the rest
+                    if (part.version == seen.versions[bucket]) {
+                        while (done < elems.size() && !crowded) {
+                            part.tree.insert(elems[done++]);
+                            crowded = part.tree.size() >= part.check_at;
+                        }
+                        part.count.store(part.tree.size(), std::memory_order_relaxed);
+                    }
+                }
+                rest.insert(rest.end(), elems.begin() + done, elems.end());
+                if (crowded) rebalance(elems[done - 1]);
+            }
+            std::lock_guard<std::mutex> guard(pending_lock);
+            pending.insert(pending.end(), rest.begin(), rest.end());
+        };
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < thread_count(threads, buckets.size()); ++i) pool.emplace_back(work);
+        work();
+        for (std::thread& worker : pool) worker.join();
+    }
+}
+
+template <typename T>
+template <typename RandomIt, typename OutputIt>
+OutputIt sharded_btree<T>::contains_bulk(RandomIt first, RandomIt last, OutputIt out, unsigned threads) const {
+    std::size_t count = last - first;
+    std::unique_ptr<bool[]> found(new bool[count]);
+    unsigned workers = thread_count(threads, count / 1024);
+    auto work = [&](unsigned worker) {
+        for (std::size_t i = count * worker / workers; i < count * (worker + 1) / workers; ++i) found[i] = contains(first[i]);
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < workers; ++i) pool.emplace_back(work, i);
+    work(0);
+    for (std::thread& worker : pool) worker.join();
+    return std::copy(found.get(), found.get() + count, out);
+}
+
+template <typename T>
+typename sharded_btree<T>::iterator sharded_btree<T>::begin() const {
+    const layout_type* seen = current.load(std::memory_order_acquire);
+    iterator first(seen, 0, seen->shards[0]->tree.cbegin());
+    first.skip_empty();
+    return first;
+}
+
+template <typename T>
+typename sharded_btree<T>::iterator sharded_btree<T>::end() const {
+    const layout_type* seen = current.load(std::memory_order_acquire);
+    return iterator(seen, seen->shards.size() - 1, seen->shards.back()->tree.cend());
+}
+
+template <typename T>
+void sharded_btree_iterator<T>::skip_empty() {
+    while (shard + 1 < layout->shards.size() && pos == layout->shards[shard]->tree.cend()) {
+        shard++;
+        pos = layout->shards[shard]->tree.cbegin();
+    }
+}
+
+template <typename T>
+sharded_btree_iterator<T>& sharded_btree_iterator<T>::operator++() {
+    ++pos;
+    skip_empty();
+    return *this;
+}
+
+template <typename T>
+sharded_btree_iterator<T> sharded_btree_iterator<T>::operator++(int) {
+    sharded_btree_iterator tmp = *this;
+    operator ++();
+    return tmp;
+}
+
+template <typename T>
+sharded_btree_iterator<T>& sharded_btree_iterator<T>::operator--() {
+    // back over empty shards to the one holding the predecessor
+    while (pos == layout->shards[shard]->tree.cbegin()) {
+        shard--;
+        pos = layout->shards[shard]->tree.cend();
+    }
+    --pos;
+    return *this;
+}
+
+template <typename T>
+sharded_btree_iterator<T> sharded_btree_iterator<T>::operator--(int) {
+    sharded_btree_iterator tmp = *this;
+    operator --();
+    return tmp;
+}
+
+#endif
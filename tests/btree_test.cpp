@@ -0,0 +1,1005 @@
+/**
+ * Checks btree against std::set over randomised workloads: inserts,
+ * lookups and walks both ways, erase and compact, buffered and hinted
+ * inserts, split and join, the order statistics and summaries, scan,
+ * and save and load.  Every check runs for both node ownership policies
+ * (see btree_ownership.h), at node capacities small enough to reach
+ * every structural path, and again with the filter and lookup cache on.
+ *
+ *   g++ -O1 -g -std=c++14 -I.. btree_test.cpp -o btree_test
+ *   g++ -O1 -g -std=c++14 -DBTREE_RAW_NODES -I.. btree_test.cpp -o btree_test_raw
+ *   ./btree_test [seed]
+ *
+ * The second build also makes raw nodes the default, which the
+ * btree_multiset, freeze(), inline buffer and recorder checks at the end
+ * then run on.  Add
+ * -fsanitize=address,undefined to catch leaked or dangling nodes, and
+ * -DBTREE_CHECKED_ITERATORS to check every iterator use.  Exits non-zero
+ * if any check failed.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "btree.h"
+#include "btree_multiset.h"
+#include "frozen_btree.h"
+
+#if !defined(BTREE_CHECKED_ITERATORS)
+// a node pointer and an index, copied as plain bytes
+static_assert(std::is_trivially_copyable<btree<int>::iterator>::value, "btree iterators must be trivially copyable");
+static_assert(std::is_trivially_copyable<btree<int>::const_iterator>::value, "btree iterators must be trivially copyable");
+static_assert(std::is_trivially_copyable<btree<std::string, btree_no_summary, btree_raw_nodes>::iterator>::value,
+	"btree iterators must be trivially copyable");
+#endif
+
+namespace {
+
+std::size_t failures = 0;
+std::string context;
+
+void check(bool ok, const char* what, int line) {
+	if (ok) return;
+	if (++failures <= 20) std::cerr << "line " << line << " (" << context << "): " << what << std::endl;
+}
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+struct config {
+	std::size_t capacity;
+	bool features;
+};
+
+template <typename Ownership>
+struct suite {
+	typedef btree<long, btree_sum<long>, Ownership> tree_type;
+
+	std::mt19937_64& rng;
+	config conf;
+
+	tree_type make() const {
+		tree_type tree(conf.capacity);
+		if (conf.features) {
+			tree.set_filter(0.01);
+			tree.set_lookup_cache(64);
+		}
+		return tree;
+	}
+
+	long key(long range) { return static_cast<long>(rng() % range); }
+
+	static bool same(const tree_type& tree, const std::set<long>& expected) {
+		return tree.size() == expected.size() && std::equal(tree.begin(), tree.end(), expected.begin(), expected.end())
+			&& std::equal(tree.rbegin(), tree.rend(), expected.rbegin(), expected.rend());
+	}
+
+	void insert_and_find() {
+		tree_type tree = make();
+		std::set<long> expected;
+		CHECK(tree.empty() && tree.begin() == tree.end());
+		for (int i = 0; i < 3000; ++i) {
+			long k = key(5000);
+			bool added = expected.insert(k).second;
+			std::pair<typename tree_type::iterator, bool> result = tree.insert(k);
+			CHECK(result.second == added && *result.first == k);
+		}
+		CHECK(same(tree, expected));
+		for (long k = -1; k <= 5000; ++k) {
+			bool present = expected.count(k) != 0;
+			typename tree_type::iterator pos = tree.find(k);
+			CHECK(present ? pos != tree.end() && *pos == k : pos == tree.end());
+			CHECK(tree.contains(k) == present);
+		}
+		// walking on from a found element, and back from end()
+		typename tree_type::iterator pos = tree.find(*expected.begin());
+		std::size_t steps = 0;
+		for (; pos != tree.end(); ++pos) steps++;
+		CHECK(steps == expected.size());
+		typename tree_type::const_iterator back = tree.cend();
+		CHECK(*--back == *expected.rbegin());
+		// present keys in order, then a shuffled mix with absent and repeated ones
+		std::vector<long> keys(expected.begin(), expected.end());
+		for (int i = 0; i < 2000; ++i) keys.push_back(key(5100) - 50);
+		std::shuffle(keys.begin() + expected.size(), keys.end(), rng);
+		std::vector<typename tree_type::const_iterator> found;
+		tree.find_batch(keys.begin(), keys.end(), std::back_inserter(found));
+		CHECK(found.size() == keys.size());
+		const tree_type& lookup = tree;
+		for (std::size_t i = 0; i < keys.size() && i < found.size(); ++i) CHECK(found[i] == lookup.find(keys[i]));
+	}
+
+	void erase_and_compact() {
+		tree_type tree = make();
+		std::set<long> expected;
+		for (int round = 0; round < 4; ++round) {
+			for (int i = 0; i < 1500; ++i) {
+				long k = key(3000);
+				if (rng() % 3 == 0) {
+					CHECK(tree.erase(k) == expected.erase(k));
+				} else {
+					CHECK(tree.insert(k).second == expected.insert(k).second);
+				}
+			}
+			CHECK(same(tree, expected));
+			while (tree.compact(50 + rng() % 500)) {}
+			CHECK(tree.tombstones() == 0);
+			CHECK(same(tree, expected));
+		}
+		// erasing by position hands back the next element
+		while (!expected.empty()) {
+			long k = *std::next(expected.begin(), rng() % expected.size());
+			std::set<long>::iterator next = expected.erase(expected.find(k));
+			typename tree_type::iterator after = tree.erase(tree.find(k));
+			CHECK(next == expected.end() ? after == tree.end() : after != tree.end() && *after == *next);
+		}
+		CHECK(tree.empty() && tree.size() == 0);
+	}
+
+	// every operation with tombstones left lying about and only partly
+	// compacted away, then erasing everything and using the tree again
+	void with_tombstones() {
+		tree_type tree = make();
+		std::set<long> expected;
+		tree.set_insert_buffer(16);
+		for (int i = 0; i < 8000; ++i) {
+			long k = key(3000);
+			switch (rng() % 10) {
+			case 0:
+			case 1:
+			case 2:
+				CHECK(tree.erase(k) == expected.erase(k));
+				break;
+			case 3:
+				tree.insert_buffered(k);
+				expected.insert(k);
+				break;
+			case 4: {
+				std::set<long>::iterator next = expected.upper_bound(k);
+				typename tree_type::const_iterator hint = next == expected.end() ? tree.cend() : tree.find(*next);
+				CHECK(*tree.insert(hint, k) == k);
+				expected.insert(k);
+				break;
+			}
+			case 5:
+				tree.compact(1 + rng() % 20);
+				break;
+			case 6: {
+				std::size_t at = expected.empty() ? 0 : rng() % expected.size();
+				typename tree_type::iterator pos = tree.select(at);
+				CHECK(expected.empty() ? pos == tree.end() : pos != tree.end() && *pos == *std::next(expected.begin(), at));
+				CHECK(tree.rank(k) == static_cast<std::size_t>(std::distance(expected.begin(), expected.lower_bound(k))));
+				break;
+			}
+			case 7: {
+				long hi = k + key(300);
+				long sum = 0;
+				std::vector<long> wanted;
+				for (std::set<long>::iterator pos = expected.lower_bound(k); pos != expected.lower_bound(hi); ++pos) {
+					sum += *pos;
+					wanted.push_back(*pos);
+				}
+				CHECK(tree.aggregate(k, hi) == sum);
+				std::vector<long> scanned;
+				tree.scan(k, hi, [](long) { return true; },
+					[&scanned](const long* first, const long* last) { scanned.insert(scanned.end(), first, last); });
+				CHECK(scanned == wanted);
+				break;
+			}
+			case 8: {
+				std::vector<long> keys;
+				for (int j = 0; j < 20; ++j) keys.push_back(key(3000));
+				std::vector<typename tree_type::const_iterator> found;
+				tree.find_batch(keys.begin(), keys.end(), std::back_inserter(found));
+				for (std::size_t j = 0; j < keys.size() && j < found.size(); ++j) {
+					CHECK(expected.count(keys[j]) == 0 ? found[j] == tree.cend() : found[j] != tree.cend() && *found[j] == keys[j]);
+				}
+				break;
+			}
+			default:
+				CHECK(tree.insert(k).second == expected.insert(k).second);
+			}
+		}
+		CHECK(same(tree, expected));
+		for (long k : expected) tree.erase(k);
+		expected.clear();
+		CHECK(tree.empty() && tree.begin() == tree.end() && tree.tombstones() > 0);
+		while (tree.compact(1 + rng() % 50)) {}
+		CHECK(tree.tombstones() == 0 && tree.empty());
+		for (int i = 0; i < 1000; ++i) {
+			long k = key(3000);
+			CHECK(tree.insert(k).second == expected.insert(k).second);
+		}
+		CHECK(same(tree, expected));
+	}
+
+	void buffered() {
+		tree_type tree = make();
+		std::set<long> expected;
+		for (int i = 0; i < 200; ++i) {
+			long k = key(4000);
+			tree.insert(k);
+			expected.insert(k);
+		}
+		tree.set_insert_buffer(8);
+		for (int i = 0; i < 4000; ++i) {
+			long k = key(4000);
+			switch (rng() % 8) {
+			case 0:
+				CHECK(tree.erase(k) == expected.erase(k));
+				break;
+			case 1:
+				CHECK(tree.contains(k) == (expected.count(k) != 0));
+				break;
+			case 2: {
+				// a found element's neighbours include the pending inserts
+				typename tree_type::iterator pos = tree.find(k);
+				std::set<long>::iterator at = expected.find(k);
+				CHECK(at != expected.end() ? pos != tree.end() && *pos == k : pos == tree.end());
+				if (at == expected.end() || pos == tree.end()) break;
+				std::set<long>::iterator next = std::next(at);
+				CHECK(next == expected.end() ? ++pos == tree.end() : *++pos == *next);
+				break;
+			}
+			default:
+				tree.insert_buffered(k);
+				expected.insert(k);
+			}
+		}
+		// copies, summaries and order statistics see the pending inserts
+		for (int i = 0; i < 50; ++i) {
+			long k = key(4000);
+			tree.insert_buffered(k);
+			expected.insert(k);
+		}
+		tree_type copy(tree);
+		CHECK(same(copy, expected));
+		long total = 0;
+		for (long k : expected) total += k;
+		CHECK(tree.summary() == total);
+		for (int i = 0; i < 50; ++i) {
+			long k = key(4000);
+			tree.insert_buffered(k);
+			expected.insert(k);
+			CHECK(tree.rank(k) == static_cast<std::size_t>(std::distance(expected.begin(), expected.find(k))));
+		}
+		tree.flush();
+		CHECK(same(tree, expected));
+		tree.set_insert_buffer(0);
+		CHECK(same(tree, expected));
+
+		tree = make();
+		for (long k = 0; k < 100; k += 2) tree.insert(k);
+		tree.set_insert_buffer(64);
+		tree.insert_buffered(11);
+		typename tree_type::iterator pos = tree.find(10);
+		CHECK(*++pos == 11);
+		tree.insert_buffered(13);
+		pos = tree.erase(tree.find(12));
+		CHECK(pos != tree.end() && *pos == 13);
+	}
+
+	void hinted() {
+		tree_type tree = make();
+		std::set<long> expected;
+		for (long k = 0; k < 2000; k += 2) {
+			CHECK(*tree.insert(tree.end(), k) == k);
+			expected.insert(k);
+		}
+		for (int i = 0; i < 2000; ++i) {
+			long k = key(4000);
+			// right hints (the successor), wrong ones and end()
+			typename tree_type::const_iterator hint = tree.cend();
+			std::set<long>::iterator next = expected.upper_bound(k);
+			if (rng() % 2 == 0 && next != expected.end()) hint = tree.find(*next);
+			else if (rng() % 2 == 0 && !expected.empty()) hint = tree.find(*expected.begin());
+			CHECK(*tree.insert(hint, k) == k);
+			expected.insert(k);
+		}
+		CHECK(same(tree, expected));
+	}
+
+	void split_and_join() {
+		for (int round = 0; round < 20; ++round) {
+			tree_type tree = make();
+			std::set<long> expected;
+			std::size_t count = rng() % 2000;
+			for (std::size_t i = 0; i < count; ++i) {
+				long k = key(4000);
+				tree.insert(k);
+				expected.insert(k);
+			}
+			for (int i = 0; i < 100; ++i) {
+				long k = key(4000);
+				CHECK(tree.erase(k) == expected.erase(k));
+			}
+			long cut = key(4000);
+			tree_type upper = tree.split(cut);
+			std::set<long> below(expected.begin(), expected.lower_bound(cut));
+			std::set<long> above(expected.lower_bound(cut), expected.end());
+			CHECK(same(tree, below));
+			CHECK(same(upper, above));
+			tree_type joined = tree_type::join(std::move(tree), std::move(upper));
+			CHECK(same(joined, expected));
+		}
+	}
+
+	// the set operations and merge() against std::set's, and join() of
+	// overlapping ranges, which falls back to a union
+	void set_algebra() {
+		for (int round = 0; round < 10; ++round) {
+			tree_type lhs = make();
+			tree_type rhs = make();
+			std::set<long> left, right;
+			for (std::size_t i = rng() % 1500; i > 0; --i) {
+				long k = key(3000);
+				lhs.insert(k);
+				left.insert(k);
+			}
+			for (std::size_t i = rng() % 1500; i > 0; --i) {
+				long k = key(3000);
+				rhs.insert(k);
+				right.insert(k);
+			}
+			// with tombstones in the way
+			for (int i = 0; i < 100; ++i) {
+				long k = key(3000);
+				CHECK(lhs.erase(k) == left.erase(k));
+			}
+			std::set<long> united, common, only;
+			std::set_union(left.begin(), left.end(), right.begin(), right.end(), std::inserter(united, united.end()));
+			std::set_intersection(left.begin(), left.end(), right.begin(), right.end(), std::inserter(common, common.end()));
+			std::set_difference(left.begin(), left.end(), right.begin(), right.end(), std::inserter(only, only.end()));
+			CHECK(same(set_union(lhs, rhs), united));
+			CHECK(same(set_intersection(lhs, rhs), common));
+			CHECK(same(set_difference(lhs, rhs), only));
+			CHECK(same(tree_type::join(lhs, rhs), united));
+			lhs.merge(rhs);
+			CHECK(same(lhs, united));
+		}
+
+		// many small pieces, some empty, joined end to end
+		tree_type joined = make();
+		std::set<long> expected;
+		for (long piece = 0; piece < 200; ++piece) {
+			tree_type part = make();
+			long count = key(5);
+			for (long k = piece * 10; k < piece * 10 + count; ++k) {
+				part.insert(k);
+				expected.insert(k);
+			}
+			joined = tree_type::join(std::move(joined), std::move(part));
+		}
+		CHECK(same(joined, expected));
+	}
+
+	void order_statistics() {
+		tree_type tree = make();
+		std::set<long> expected;
+		for (int i = 0; i < 3000; ++i) {
+			long k = key(6000);
+			tree.insert(k);
+			expected.insert(k);
+			if (rng() % 4 == 0) {
+				k = key(6000);
+				tree.erase(k);
+				expected.erase(k);
+			}
+		}
+		std::vector<long> sorted(expected.begin(), expected.end());
+		for (std::size_t k = 0; k < sorted.size(); k += 7) {
+			typename tree_type::iterator pos = tree.select(k);
+			CHECK(pos != tree.end() && *pos == sorted[k]);
+			CHECK(tree.index_of(pos) == k);
+			CHECK(tree.rank(sorted[k]) == k);
+			CHECK(tree.distance(tree.cbegin(), pos) == static_cast<std::ptrdiff_t>(k));
+			CHECK(distance(tree.begin(), pos) == static_cast<std::ptrdiff_t>(k));
+			CHECK(distance(pos, tree.begin()) == -static_cast<std::ptrdiff_t>(k));
+		}
+		CHECK(tree.select(sorted.size()) == tree.end());
+		CHECK(tree.index_of(tree.cend()) == sorted.size());
+		long total = 0;
+		for (long k : sorted) total += k;
+		CHECK(tree.summary() == total);
+		for (int i = 0; i < 200; ++i) {
+			long lo = key(6000);
+			long hi = lo + key(1000);
+			long sum = 0;
+			std::vector<long> odd;
+			for (std::set<long>::iterator pos = expected.lower_bound(lo); pos != expected.lower_bound(hi); ++pos) {
+				sum += *pos;
+				if (*pos % 2 != 0) odd.push_back(*pos);
+			}
+			CHECK(tree.aggregate(lo, hi) == sum);
+			CHECK(tree.rank(hi) - tree.rank(lo) == static_cast<std::size_t>(std::distance(expected.lower_bound(lo),
+				expected.lower_bound(hi))));
+			std::vector<long> scanned;
+			std::size_t matched = tree.scan(lo, hi, [](long k) { return k % 2 != 0; },
+				[&scanned](const long* first, const long* last) { scanned.insert(scanned.end(), first, last); });
+			CHECK(matched == odd.size() && scanned == odd);
+		}
+	}
+
+	// scan() hands the matches over in batches of at most scan_batch, and
+	// nothing at all for an empty or inverted range
+	void scan_batches() {
+		tree_type tree = make();
+		std::set<long> expected;
+		for (int i = 0; i < 20000; ++i) {
+			long k = key(60000);
+			tree.insert(k);
+			expected.insert(k);
+		}
+		for (int i = 0; i < 100; ++i) {
+			long lo = key(70000) - 5000;
+			long hi = key(70000) - 5000;
+			long every = key(5) + 1;
+			std::vector<long> wanted;
+			for (std::set<long>::iterator pos = expected.lower_bound(lo); lo < hi && pos != expected.lower_bound(hi); ++pos) {
+				if (*pos % every == 0) wanted.push_back(*pos);
+			}
+			std::vector<long> scanned;
+			bool small = true;
+			std::size_t matched = tree.scan(lo, hi, [every](long k) { return k % every == 0; },
+				[&](const long* first, const long* last) {
+					small = small && first < last && static_cast<std::size_t>(last - first) <= tree_type::scan_batch;
+					scanned.insert(scanned.end(), first, last);
+				});
+			CHECK(small && matched == wanted.size() && scanned == wanted);
+		}
+		std::size_t calls = 0;
+		CHECK(tree.scan(500, 500, [](long) { return true; }, [&calls](const long*, const long*) { ++calls; }) == 0);
+		CHECK(tree.scan(900, 100, [](long) { return true; }, [&calls](const long*, const long*) { ++calls; }) == 0);
+		CHECK(calls == 0);
+	}
+
+	void save_and_load() {
+		for (std::size_t count : {0, 5, 3000}) {
+			tree_type tree = make();
+			std::set<long> expected;
+			for (std::size_t i = 0; i < count; ++i) {
+				long k = key(10000);
+				tree.insert(k);
+				expected.insert(k);
+			}
+			for (std::size_t i = 0; i < count / 4; ++i) {
+				long k = key(10000);
+				tree.erase(k);
+				expected.erase(k);
+			}
+			std::stringstream snapshot;
+			CHECK(tree.save(snapshot));
+			tree_type loaded = make();
+			loaded.insert(-1);
+			CHECK(loaded.load(snapshot));
+			CHECK(same(loaded, expected));
+
+			// a truncated snapshot is refused and leaves the btree as it was
+			std::string bytes = snapshot.str();
+			if (bytes.size() < 2) continue;
+			std::stringstream truncated(bytes.substr(0, bytes.size() - 1));
+			tree_type kept = make();
+			kept.insert(-1);
+			CHECK(!kept.load(truncated) || count == 0);
+			CHECK(kept.size() == 1 && *kept.begin() == -1);
+		}
+	}
+
+	void copy_and_move() {
+		tree_type tree = make();
+		std::set<long> expected;
+		for (int i = 0; i < 1000; ++i) {
+			long k = key(2000);
+			tree.insert(k);
+			expected.insert(k);
+		}
+		tree_type copy(tree);
+		tree_type moved(std::move(copy));
+		CHECK(same(moved, expected) && copy.empty());
+		copy = moved;
+		moved = std::move(tree);
+		CHECK(same(copy, expected) && same(moved, expected));
+		copy.insert(-5);
+		CHECK(!moved.contains(-5));
+		tree_type merged = make();
+		merged.insert(-5);
+		merged.merge(moved);
+		expected.insert(-5);
+		CHECK(same(merged, expected));
+		std::ostringstream os;
+		os << merged;
+		CHECK(!os.str().empty());
+	}
+
+	tree_type thousand() {
+		tree_type tree = make();
+		for (long k = 0; k < 1000; ++k) tree.insert(3 * k);
+		return tree;
+	}
+
+	// the filter follows the number of elements, not the number of inserts
+	void filter_sizing() {
+		tree_type tree = thousand();
+		std::size_t bytes = tree.filter_bytes();
+		for (int i = 0; i < 20000; ++i) {
+			long k = 3 * key(1000);
+			tree.insert(k);
+			tree.insert(tree.cend(), k);
+		}
+		CHECK(tree.filter_bytes() == bytes);
+
+		// each half of a split keeps the whole filter, and an element
+		// coming and going between joins may leave the filter full once
+		tree = thousand();
+		for (int round = 0; round < 30; ++round) {
+			tree_type upper = tree.split(3 * key(1000));
+			tree = tree_type::join(std::move(tree), std::move(upper));
+			tree.insert(3 * round + 1);
+			tree.erase(3 * round + 1);
+		}
+		CHECK(tree.size() == 1000 && tree.filter_bytes() <= 2 * bytes);
+		for (long k = 0; k < 1000; ++k) CHECK(tree.contains(3 * k) && !tree.contains(3 * k + 1));
+
+		// pending inserts need room in the filter as well, and with a few
+		// hundred nodes buffering 8 each they outnumber the elements; a
+		// filter that followed the inserts would have grown a hundredfold
+		tree = thousand();
+		tree.set_insert_buffer(8);
+		for (int i = 0; i < 100000; ++i) tree.insert_buffered(3 * key(1000));
+		tree.set_insert_buffer(0);
+		CHECK(tree.size() == 1000 && tree.filter_bytes() < 8 * bytes);
+	}
+
+	// the lookup cache counts what it is asked and what it answers, and
+	// never hands back a position that an insert, erase or compact moved
+	void lookup_cache() {
+		tree_type tree(conf.capacity);
+		for (long k = 0; k < 100; ++k) tree.insert(3 * k);
+		CHECK(tree.contains(30) && tree.cache_lookups() == 0);
+		tree.set_lookup_cache(64);
+		CHECK(tree.contains(30) && tree.contains(30) && *tree.find(30) == 30);
+		CHECK(!tree.contains(31));
+		CHECK(tree.cache_lookups() == 4 && tree.cache_hits() == 2);
+		tree_type copy(tree);
+		CHECK(copy.contains(30) && copy.cache_lookups() == 1 && copy.cache_hits() == 0);
+
+		// hot keys looked up between changes that split, merge and compact
+		// the nodes they sit in
+		std::set<long> expected;
+		for (long k = 0; k < 100; ++k) expected.insert(3 * k);
+		for (int i = 0; i < 4000; ++i) {
+			long k = key(600);
+			if (rng() % 3 == 0) {
+				CHECK(tree.erase(k) == expected.erase(k));
+			} else {
+				CHECK(tree.insert(k).second == expected.insert(k).second);
+			}
+			if (i % 500 == 0) while (tree.compact(50)) {}
+			long hot = 3 * key(10);
+			bool present = expected.count(hot) != 0;
+			typename tree_type::iterator pos = tree.find(hot);
+			CHECK(present ? pos != tree.end() && *pos == hot : pos == tree.end());
+			CHECK(tree.contains(hot) == present);
+		}
+		CHECK(same(tree, expected));
+		CHECK(tree.cache_hits() > 0 && tree.cache_hits() < tree.cache_lookups());
+		tree.set_lookup_cache(0);
+		CHECK(tree.contains(*expected.begin()) && tree.cache_lookups() == 0);
+	}
+
+	void run() {
+		insert_and_find();
+		erase_and_compact();
+		with_tombstones();
+		buffered();
+		hinted();
+		split_and_join();
+		set_algebra();
+		order_statistics();
+		scan_batches();
+		save_and_load();
+		copy_and_move();
+		lookup_cache();
+		if (conf.features) filter_sizing();
+	}
+};
+
+template <typename Ownership>
+void run_all(const char* name, std::mt19937_64& rng) {
+	for (std::size_t capacity : {3, 4, 16}) {
+		for (bool features : {false, true}) {
+			context = std::string(name) + ", capacity " + std::to_string(capacity) + (features ? ", filter and cache" : "");
+			suite<Ownership>{rng, config{capacity, features}}.run();
+		}
+	}
+}
+
+// combine() is not commutative, so a fold that took its arguments out
+// of key order shows
+struct in_order {
+	typedef std::string value_type;
+
+	value_type identity() const { return value_type(); }
+	value_type extract(long elem) const { return std::to_string(elem) + ","; }
+	value_type combine(const value_type& lhs, const value_type& rhs) const { return lhs + rhs; }
+};
+
+// summaries other than a sum, kept right through erases, splits and joins
+void run_summaries(std::mt19937_64& rng) {
+	context = "summaries";
+	btree<long, in_order> listed(3);
+	btree<long, btree_min<long>> lowest(4);
+	btree<long, btree_max<long>> highest(4);
+	std::set<long> expected;
+	for (int i = 0; i < 1500; ++i) {
+		long k = static_cast<long>(rng() % 2000);
+		if (rng() % 4 == 0) {
+			listed.erase(k);
+			lowest.erase(k);
+			highest.erase(k);
+			expected.erase(k);
+		} else {
+			listed.insert(k);
+			lowest.insert(k);
+			highest.insert(k);
+			expected.insert(k);
+		}
+	}
+	auto fold = [&](long lo, long hi) {
+		std::string text;
+		for (std::set<long>::iterator pos = expected.lower_bound(lo); pos != expected.lower_bound(hi); ++pos) {
+			text += std::to_string(*pos) + ",";
+		}
+		return text;
+	};
+	for (int i = 0; i < 300; ++i) {
+		long lo = static_cast<long>(rng() % 2100) - 50;
+		long hi = lo + static_cast<long>(rng() % 400);
+		std::set<long>::iterator first = expected.lower_bound(lo);
+		std::set<long>::iterator last = expected.lower_bound(hi);
+		CHECK(listed.aggregate(lo, hi) == fold(lo, hi));
+		CHECK(lowest.aggregate(lo, hi) == (first == last ? std::numeric_limits<long>::max() : *first));
+		CHECK(highest.aggregate(lo, hi) == (first == last ? std::numeric_limits<long>::lowest() : *std::prev(last)));
+	}
+	CHECK(listed.summary() == fold(-1, 2000));
+	for (int round = 0; round < 10; ++round) {
+		long cut = static_cast<long>(rng() % 2000);
+		btree<long, in_order> upper = listed.split(cut);
+		CHECK(listed.summary() == fold(-1, cut) && upper.summary() == fold(cut, 2000));
+		btree<long, btree_min<long>> high_half = lowest.split(cut);
+		CHECK(high_half.summary() == *expected.lower_bound(cut) || expected.lower_bound(cut) == expected.end());
+		listed = btree<long, in_order>::join(std::move(listed), std::move(upper));
+		lowest = btree<long, btree_min<long>>::join(std::move(lowest), std::move(high_half));
+		CHECK(listed.summary() == fold(-1, 2000) && lowest.summary() == *expected.begin());
+	}
+}
+
+// the containers built on btree<T> with the default ownership
+void run_defaults(std::mt19937_64& rng) {
+	context = "btree_multiset and freeze()";
+	btree_multiset<long> counted(4);
+	std::multiset<long> expected;
+	btree<long> distinct(4);
+	for (int i = 0; i < 2000; ++i) {
+		long k = static_cast<long>(rng() % 300);
+		counted.insert(k);
+		expected.insert(k);
+		distinct.insert(k);
+	}
+	CHECK(counted.size() == expected.size() && std::equal(counted.begin(), counted.end(), expected.begin()));
+	CHECK(counted.distinct_size() == distinct.size());
+	// every copy again on the way back, and find() at the first of them
+	btree_multiset<long>::iterator back = counted.end();
+	for (std::multiset<long>::reverse_iterator it = expected.rbegin(); it != expected.rend(); ++it) CHECK(*--back == *it);
+	CHECK(back == counted.begin());
+	for (long k = -1; k <= 300; ++k) {
+		CHECK(counted.count(k) == expected.count(k));
+		btree_multiset<long>::iterator at = counted.find(k);
+		CHECK(expected.count(k) == 0 ? at == counted.end()
+			: at != counted.end() && *at == k && (at == counted.begin() || *std::prev(at) < k));
+	}
+	btree_multiset<std::string> words;
+	for (const char* word : {"b", "a", "b", "c", "b"}) words.insert(word);
+	CHECK(words.size() == 5 && words.distinct_size() == 3 && words.count("b") == 3 && words.find("d") == words.end());
+	frozen_btree<long> frozen = distinct.freeze();
+	CHECK(frozen.size() == distinct.size() && std::equal(frozen.begin(), frozen.end(), distinct.begin()));
+
+	context = "scan over strings";
+	btree<std::string> numbers;
+	for (int i = 0; i < 1000; ++i) numbers.insert(std::to_string(i));
+	std::vector<std::string> scanned;
+	numbers.scan("1", "2", [](const std::string& s) { return s.size() == 3; },
+		[&scanned](const std::string* first, const std::string* last) { scanned.insert(scanned.end(), first, last); });
+	CHECK(scanned.size() == 100 && scanned.front() == "100" && scanned.back() == "199");
+}
+
+// frozen_btree searches and walks its Eytzinger layout like std::set, at
+// sizes that fill the implicit tree exactly, leave one slot over or
+// stop one short
+void run_frozen(std::mt19937_64& rng) {
+	for (std::size_t count : {0, 1, 2, 3, 6, 7, 8, 15, 16, 17, 1000}) {
+		context = "frozen_btree of " + std::to_string(count);
+		std::set<long> expected;
+		while (expected.size() < count) expected.insert(static_cast<long>(rng() % (4 * count)) * 2);
+		frozen_btree<long> frozen(expected.begin(), expected.end());
+		CHECK(frozen.size() == count && frozen.empty() == (count == 0));
+		CHECK(std::equal(frozen.begin(), frozen.end(), expected.begin(), expected.end()));
+		CHECK(std::equal(frozen.rbegin(), frozen.rend(), expected.rbegin(), expected.rend()));
+		auto same = [&](frozen_btree<long>::iterator pos, std::set<long>::const_iterator want) {
+			return pos == frozen.end() ? want == expected.end() : want != expected.end() && *pos == *want;
+		};
+		for (long k = -1; k <= static_cast<long>(8 * count) + 1; ++k) {
+			CHECK(same(frozen.lower_bound(k), expected.lower_bound(k)));
+			CHECK(same(frozen.upper_bound(k), expected.upper_bound(k)));
+			CHECK(same(frozen.find(k), expected.find(k)));
+			CHECK(frozen.contains(k) == (expected.count(k) != 0));
+		}
+		// stepping back from end() and from a bound in the middle
+		frozen_btree<long>::iterator back = frozen.end();
+		for (std::set<long>::const_reverse_iterator it = expected.rbegin(); it != expected.rend(); ++it) CHECK(*--back == *it);
+		CHECK(back == frozen.begin());
+		if (count != 0) {
+			long middle = *std::next(expected.begin(), count / 2);
+			frozen_btree<long>::iterator at = frozen.upper_bound(middle);
+			CHECK(*--at == middle);
+		}
+	}
+}
+
+// snapshots of strings survive a round trip, and load() refuses any
+// stream that is not a whole, ordered snapshot of its element type,
+// setting failbit and keeping what it had
+void run_io(std::mt19937_64& rng) {
+	context = "btree_io<std::string>";
+	btree<std::string> strings(4);
+	std::set<std::string> expected;
+	// empty, short and longer than btree_io's read chunk
+	for (std::size_t length : {0, 1, 7, 100, 5000}) {
+		for (int i = 0; i < 20; ++i) {
+			std::string s(length, 'a');
+			for (char& c : s) c = static_cast<char>('a' + rng() % 3);
+			strings.insert(s);
+			expected.insert(s);
+		}
+	}
+	std::stringstream snapshot;
+	CHECK(strings.save(snapshot));
+	btree<std::string> loaded(4);
+	loaded.insert("stale");
+	CHECK(loaded.load(snapshot));
+	CHECK(loaded.size() == expected.size() && std::equal(loaded.begin(), loaded.end(), expected.begin()));
+
+	auto refused = [](const std::string& bytes) {
+		std::stringstream in(bytes);
+		btree<std::string> kept(4);
+		kept.insert("kept");
+		bool loaded = kept.load(in);
+		return !loaded && in.fail() && kept.size() == 1 && *kept.begin() == "kept";
+	};
+	std::string bytes = snapshot.str();
+	for (std::size_t cut = 0; cut < bytes.size(); cut += 1 + cut / 8) CHECK(refused(bytes.substr(0, cut)));
+	std::string corrupt = bytes;
+	corrupt[0] ^= 1;
+	CHECK(refused(corrupt));
+	// a string length far beyond what the stream holds
+	corrupt = bytes;
+	corrupt[btree_header_io::magic_bytes + 2 * sizeof(std::uint64_t) + 6] = 0x7f;
+	CHECK(refused(corrupt));
+
+	context = "btree snapshot checks";
+	btree<int> narrow;
+	narrow.insert(1);
+	std::stringstream wrong_size;
+	narrow.save(wrong_size);
+	btree<long> wide_keys;
+	wide_keys.insert(5);
+	CHECK(!wide_keys.load(wrong_size) && wrong_size.fail() && wide_keys.size() == 1);
+	for (std::vector<long> elements : {std::vector<long>{1, 3, 2}, std::vector<long>{1, 2, 2}}) {
+		btree_snapshot_header header;
+		header.element_size = sizeof(long);
+		header.count = elements.size();
+		std::stringstream unordered;
+		header.write(unordered);
+		btree_io<long>::write(unordered, elements.data(), elements.size());
+		CHECK(!wide_keys.load(unordered) && unordered.fail() && wide_keys.size() == 1 && *wide_keys.begin() == 5);
+	}
+}
+
+// too large for the default inline buffer, which then takes no room
+struct wide {
+	long key;
+	char padding[120];
+
+	bool operator<(const wide& rhs) const { return key < rhs.key; }
+	bool operator==(const wide& rhs) const { return key == rhs.key; }
+};
+
+// the inline buffer, with a T that must be moved and destroyed properly
+// on its way into nodes and back
+void run_inline(std::mt19937_64& rng) {
+	context = "inline buffer";
+	// long enough to live on the heap, so a bad move or a missed destructor shows
+	auto text = [](unsigned long k) { return std::string(40, '.') + std::to_string(k); };
+	btree<std::string> tree(3);
+	std::set<std::string> expected;
+	for (int i = 0; i < 3000; ++i) {
+		std::string s = text(rng() % 12);
+		if (rng() % 3 == 0) {
+			tree.erase(s);
+			expected.erase(s);
+			if (rng() % 4 == 0) while (tree.compact(64)) {}
+		} else {
+			tree.insert(s);
+			expected.insert(s);
+		}
+		CHECK(tree.size() == expected.size() && std::equal(tree.begin(), tree.end(), expected.begin()));
+		if (i % 100 == 0) {
+			btree<std::string> copy(tree);
+			btree<std::string> moved(std::move(copy));
+			CHECK(std::equal(moved.begin(), moved.end(), expected.begin()) && moved.size() == expected.size());
+			btree<std::string> upper = moved.split(text(6));
+			moved = btree<std::string>::join(std::move(moved), std::move(upper));
+			CHECK(std::equal(moved.begin(), moved.end(), expected.begin()) && moved.size() == expected.size());
+		}
+	}
+
+	context = "no inline buffer";
+	CHECK(btree_inline_capacity<wide>::value == 0);
+	CHECK(sizeof(btree<wide>) < sizeof(wide));
+	btree<wide> wides(3);
+	for (long k = 0; k < 20; ++k) wides.insert(wide{(k * 7) % 20, {}});
+	long next = 0;
+	for (const wide& w : wides) CHECK(w.key == next++);
+	CHECK(next == 20);
+}
+
+// the filter over strings, and over a type std::hash does not cover,
+// which gets no filter at all
+void run_filters(std::mt19937_64& rng) {
+	context = "filter on strings";
+	btree<std::string> words(8);
+	words.set_filter(0.01);
+	std::set<std::string> expected;
+	for (int i = 0; i < 3000; ++i) {
+		std::string word = std::to_string(rng() % 6000);
+		words.insert(word);
+		expected.insert(word);
+	}
+	CHECK(words.filter_bytes() > 0);
+	for (int k = 0; k < 6000; ++k) CHECK(words.contains(std::to_string(k)) == (expected.count(std::to_string(k)) != 0));
+
+	context = "filter without a hash";
+	btree<wide> wides(3);
+	wides.set_filter(0.01);
+	for (long k = 0; k < 200; k += 2) wides.insert(wide{k, {}});
+	CHECK(wides.filter_bytes() == 0);
+	for (long k = 0; k < 200; ++k) CHECK(wides.contains(wide{k, {}}) == (k % 2 == 0));
+}
+
+// the recorder logs what the caller asked for, walks with their direction
+void run_trace(std::mt19937_64& rng) {
+	context = "btree_recorder";
+	btree<long> lhs(4), rhs(4);
+	for (int i = 0; i < 500; ++i) {
+		lhs.insert(static_cast<long>(rng() % 1000));
+		rhs.insert(static_cast<long>(rng() % 1000));
+	}
+	std::stringstream trace;
+	{
+		btree_recorder<long> recorder(trace);
+		lhs.set_recorder(&recorder);
+		rhs.set_recorder(&recorder);
+		set_union(lhs, rhs);
+		set_intersection(lhs, rhs);
+		set_difference(lhs, rhs);
+		lhs.freeze();
+		lhs.rbegin();
+		lhs.crbegin();
+		lhs.begin();
+		// copies and moves start out unrecorded, and assignment keeps the recorder
+		btree<long> copy(lhs);
+		btree<long> moved(std::move(copy));
+		copy.insert(1);
+		moved.insert(1);
+		lhs = rhs;
+		lhs = std::move(moved);
+		moved.insert(2);
+		lhs.contains(7);
+		lhs.set_recorder(nullptr);
+		rhs.set_recorder(nullptr);
+	}
+	btree_trace_reader<long> reader(trace);
+	std::vector<btree_op> seen;
+	btree_trace_event<long> event;
+	while (reader.next(event)) seen.push_back(event.op);
+	std::vector<btree_op> expected = {btree_op::reverse_iterate, btree_op::reverse_iterate, btree_op::iterate, btree_op::contains};
+	CHECK(reader.good() && seen == expected && event.elem == 7);
+
+	// each public call once, with its element, in order and in time order
+	context = "btree_recorder events";
+	std::stringstream log;
+	std::vector<std::pair<btree_op, long>> calls;
+	{
+		btree_recorder<long> recorder(log);
+		lhs.set_recorder(&recorder);
+		for (int i = 0; i < 2000; ++i) {
+			long k = static_cast<long>(rng() % 1000);
+			switch (rng() % 4) {
+			case 0:
+				lhs.insert(k);
+				calls.push_back(std::make_pair(btree_op::insert, k));
+				break;
+			case 1:
+				lhs.find(k);
+				calls.push_back(std::make_pair(btree_op::find, k));
+				break;
+			case 2:
+				lhs.contains(k);
+				calls.push_back(std::make_pair(btree_op::contains, k));
+				break;
+			default:
+				lhs.erase(k);
+				calls.push_back(std::make_pair(btree_op::erase, k));
+			}
+		}
+		std::vector<long> keys = {3, 1, 4};
+		std::vector<btree<long>::const_iterator> found;
+		lhs.find_batch(keys.begin(), keys.end(), std::back_inserter(found));
+		for (long k : keys) calls.push_back(std::make_pair(btree_op::find, k));
+		lhs.insert(5);
+		btree<long>::iterator pos = lhs.find(5);
+		lhs.erase(pos);
+		calls.push_back(std::make_pair(btree_op::insert, 5L));
+		calls.push_back(std::make_pair(btree_op::find, 5L));
+		calls.push_back(std::make_pair(btree_op::erase, 5L));
+		lhs.set_recorder(nullptr);
+	}
+	std::string bytes = log.str();
+	std::stringstream in(bytes);
+	btree_trace_reader<long> events(in);
+	std::size_t count = 0;
+	std::uint64_t last = 0;
+	bool ordered = true;
+	while (events.next(event)) {
+		if (count < calls.size()) ordered = ordered && event.op == calls[count].first && event.elem == calls[count].second;
+		ordered = ordered && event.time >= last;
+		last = event.time;
+		count++;
+	}
+	CHECK(events.good() && ordered && count == calls.size());
+	// a trace of longs is not read back as ints
+	std::stringstream narrow(bytes);
+	btree_trace_reader<int> wrong(narrow);
+	CHECK(!wrong.good());
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	std::mt19937_64 rng(argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 42);
+	run_all<btree_shared_nodes>("shared nodes", rng);
+	run_all<btree_raw_nodes>("raw nodes", rng);
+	run_summaries(rng);
+	run_defaults(rng);
+	run_frozen(rng);
+	run_io(rng);
+	run_inline(rng);
+	run_filters(rng);
+	run_trace(rng);
+	if (failures != 0) {
+		std::cout << failures << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "all checks passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,197 @@
+/**
+ * Checks sharded_btree against std::set: ordered walks across shards,
+ * empty ones included, contains_bulk, where rebalancing puts the split
+ * points, and inserts and lookups from several threads at once while
+ * the shards split and trade elements.
+ *
+ *   g++ -O1 -g -std=c++14 -pthread -I.. sharded_btree_test.cpp -o sharded_btree_test
+ *   ./sharded_btree_test [seed]
+ *
+ * Add -fsanitize=thread to check the locking, or
+ * -fsanitize=address,undefined for everything else.  Exits non-zero if
+ * any check failed.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sharded_btree.h"
+
+namespace {
+
+std::size_t failures = 0;
+std::string context;
+
+void check(bool ok, const char* what, int line) {
+	if (ok) return;
+	if (++failures <= 20) std::cerr << "line " << line << " (" << context << "): " << what << std::endl;
+}
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+bool same(const sharded_btree<long>& tree, const std::set<long>& expected) {
+	if (tree.size() != expected.size() || !std::equal(tree.begin(), tree.end(), expected.begin(), expected.end())) return false;
+	// and back from end(), across the same shards
+	sharded_btree<long>::iterator pos = tree.end();
+	for (std::set<long>::const_reverse_iterator it = expected.rbegin(); it != expected.rend(); ++it) {
+		if (*--pos != *it) return false;
+	}
+	return pos == tree.begin();
+}
+
+// shards split from a sample, some of them left empty, walked both ways
+void run_iteration(std::mt19937_64& rng) {
+	context = "iteration";
+	sharded_btree<long> tree(6);
+	CHECK(tree.empty() && tree.begin() == tree.end());
+	std::vector<long> sample;
+	for (long k = 0; k < 600; k += 10) sample.push_back(k);
+	tree.partition(sample.begin(), sample.end());
+	CHECK(tree.shard_count() == 6);
+	// nothing between 100 and 400, so the middle shards stay empty
+	std::set<long> expected;
+	for (int i = 0; i < 3000; ++i) {
+		long k = static_cast<long>(rng() % 700);
+		if (k >= 100 && k < 400) continue;
+		CHECK(tree.insert(k) == expected.insert(k).second);
+	}
+	CHECK(same(tree, expected));
+	// partitioning again keeps every element
+	std::vector<long> other;
+	for (long k = 0; k < 100; ++k) other.push_back(7 * k);
+	tree.partition(other.begin(), other.end());
+	CHECK(same(tree, expected));
+}
+
+void run_contains_bulk(std::mt19937_64& rng) {
+	context = "contains_bulk";
+	sharded_btree<long> tree(8);
+	std::set<long> expected;
+	std::vector<long> keys;
+	for (int i = 0; i < 30000; ++i) keys.push_back(static_cast<long>(rng() % 60000));
+	tree.insert_bulk(keys.begin(), keys.end(), 4);
+	expected.insert(keys.begin(), keys.end());
+	CHECK(same(tree, expected));
+	CHECK(tree.shard_count() > 1);
+	std::vector<long> probes;
+	for (int i = 0; i < 20000; ++i) probes.push_back(static_cast<long>(rng() % 70000) - 5000);
+	for (unsigned threads : {1u, 4u}) {
+		std::vector<bool> found;
+		tree.contains_bulk(probes.begin(), probes.end(), std::back_inserter(found), threads);
+		CHECK(found.size() == probes.size());
+		for (std::size_t i = 0; i < probes.size() && i < found.size(); ++i) CHECK(found[i] == (expected.count(probes[i]) != 0));
+	}
+}
+
+// the elements of expected in [lo, hi)
+std::size_t in_range(const std::set<long>& expected, long lo, long hi) {
+	return std::distance(expected.lower_bound(lo), expected.lower_bound(hi));
+}
+
+void run_rebalance(std::mt19937_64& rng) {
+	// a crowded shard is split at its median, whatever the insert order
+	context = "split at the median";
+	sharded_btree<long> tree(3);
+	std::set<long> expected;
+	std::vector<long> keys;
+	for (long k = 0; k < 4096; ++k) keys.push_back(3 * k);
+	std::shuffle(keys.begin(), keys.end(), rng);
+	for (long key : keys) {
+		tree.insert(key);
+		expected.insert(key);
+	}
+	std::vector<long> bounds = tree.split_points();
+	CHECK(bounds.size() == 1 && bounds[0] == *std::next(expected.begin(), 2048));
+	CHECK(same(tree, expected));
+
+	// growing the top shard splits it too, using up the shards, and then
+	// makes it hand half its surplus to the smaller neighbour
+	context = "move to a neighbour";
+	long next = 3 * 4096;
+	while (tree.shard_count() < 3) {
+		tree.insert(next);
+		expected.insert(next++);
+	}
+	bounds = tree.split_points();
+	CHECK(bounds.size() == 2);
+	bool moved = false;
+	while (!moved && next < 100000) {
+		std::size_t middle = in_range(expected, bounds[0], bounds[1]);
+		std::size_t top = in_range(expected, bounds[1], next + 1);
+		tree.insert(next);
+		expected.insert(next++);
+		std::vector<long> now = tree.split_points();
+		if (now == bounds) continue;
+		moved = true;
+		CHECK(now.size() == 2 && now[0] == bounds[0] && now[1] > bounds[1]);
+		CHECK(in_range(expected, bounds[1], now[1]) == (top + 1 - middle) / 2);
+	}
+	CHECK(moved);
+	CHECK(same(tree, expected));
+}
+
+// writers on overlapping keys, and readers checking what their own
+// writes made visible, while the shards split and trade elements
+void run_threads(std::mt19937_64& rng) {
+	context = "concurrent inserts";
+	const unsigned writers = 4;
+	const long per_writer = 40000;
+	sharded_btree<long> tree(8);
+	std::atomic<std::size_t> inserted{0};
+	std::atomic<std::size_t> missing{0};
+	std::vector<std::thread> pool;
+	for (unsigned t = 0; t < writers; ++t) {
+		unsigned long seed = rng();
+		pool.emplace_back([&, t, seed]() {
+			std::mt19937_64 local(seed);
+			std::size_t mine = 0;
+			for (long i = 0; i < per_writer; ++i) {
+				// every key is wanted by two writers
+				long key = (i * writers + t) / 2;
+				mine += tree.insert(key);
+				if (!tree.contains(key)) missing++;
+				long earlier = (static_cast<long>(local() % (i + 1)) * writers + t) / 2;
+				if (!tree.contains(earlier)) missing++;
+			}
+			inserted += mine;
+		});
+	}
+	// and a bulk load of keys beyond the writers', at the same time
+	std::vector<long> bulk;
+	for (long k = 0; k < 50000; ++k) bulk.push_back(per_writer * writers + static_cast<long>(rng() % 100000));
+	pool.emplace_back([&]() { tree.insert_bulk(bulk.begin(), bulk.end(), 2); });
+	for (std::thread& worker : pool) worker.join();
+
+	std::set<long> expected(bulk.begin(), bulk.end());
+	for (long key = 0; key < per_writer * writers / 2; ++key) expected.insert(key);
+	CHECK(missing == 0);
+	CHECK(inserted == per_writer * writers / 2);
+	CHECK(tree.shard_count() == 8);
+	CHECK(same(tree, expected));
+	std::vector<long> bounds = tree.split_points();
+	CHECK(std::is_sorted(bounds.begin(), bounds.end()) && bounds.size() == 7);
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	std::mt19937_64 rng(argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 42);
+	run_iteration(rng);
+	run_contains_bulk(rng);
+	run_rebalance(rng);
+	run_threads(rng);
+	if (failures != 0) {
+		std::cout << failures << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "all checks passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,115 @@
+/**
+ * Measures insert, find and in-order scan throughput of btree<T> across a
+ * range of node capacities, to pick the best node size for a workload.
+ *
+ *   g++ -O2 -std=c++14 -I.. btree_capacity_sweep.cpp -o btree_capacity_sweep
+ *   ./btree_capacity_sweep [type] [count] [capacity...]
+ *
+ * type is one of int32, int64, string, record64 and record256 (a key
+ * plus padding up to that many bytes).  Without explicit capacities the
+ * sweep covers the capacities of nodes from 64 bytes to 64 KiB, counting
+ * both the elements and the child slots (see btree::capacity_for).
+ * Keys are inserted in random order and looked up in another random
+ * order, half of them missing.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench/bench_util.h"
+#include "btree.h"
+
+namespace {
+
+template <std::size_t Bytes>
+struct record {
+	std::int64_t key;
+	char payload[Bytes - sizeof(std::int64_t)];
+
+	bool operator<(const record& rhs) const { return key < rhs.key; }
+	bool operator==(const record& rhs) const { return key == rhs.key; }
+};
+
+template <typename T> T make_key(std::int64_t key) { return static_cast<T>(key); }
+
+template <> std::string make_key<std::string>(std::int64_t key) {
+	std::string padded = std::to_string(key);
+	return std::string(12 - padded.size(), '0') + padded;
+}
+
+template <> record<64> make_key<record<64>>(std::int64_t key) { return record<64>{key, {}}; }
+template <> record<256> make_key<record<256>>(std::int64_t key) { return record<256>{key, {}}; }
+
+template <typename T>
+void sweep(std::size_t count, std::vector<std::size_t> capacities) {
+	std::mt19937_64 rng(7);
+	std::vector<T> inserts;
+	std::vector<T> lookups;
+	for (std::size_t i = 0; i < count; ++i) {
+		inserts.push_back(make_key<T>(2 * i));
+		lookups.push_back(make_key<T>(2 * i + rng() % 2));
+	}
+	std::shuffle(inserts.begin(), inserts.end(), rng);
+	std::shuffle(lookups.begin(), lookups.end(), rng);
+
+	if (capacities.empty()) {
+		for (std::size_t bytes = 64; bytes <= 65536; bytes *= 2) {
+			std::size_t capacity = btree<T>::capacity_for(bytes);
+			if (capacities.empty() || capacities.back() != capacity) capacities.push_back(capacity);
+		}
+	}
+
+	std::cout << count << " elements of " << sizeof(T) << " bytes, default capacity "
+		<< btree<T>().get_max_elem() << std::endl;
+	std::cout << std::setw(10) << "capacity" << std::setw(12) << "node bytes" << std::setw(14) << "insert ns/op"
+		<< std::setw(12) << "find ns/op" << std::setw(14) << "scan ns/elem" << std::endl;
+	for (std::size_t capacity : capacities) {
+		btree<T> tree(capacity);
+		clock_type::time_point start = clock_type::now();
+		for (const T& elem : inserts) tree.insert(elem);
+		double insert_ns = ns_since(start, count);
+
+		std::size_t found = 0;
+		const btree<T>& lookup = tree;
+		typename btree<T>::const_iterator missing = lookup.cend();
+		start = clock_type::now();
+		for (const T& elem : lookups) found += lookup.find(elem) != missing;
+		double find_ns = ns_since(start, count);
+
+		std::size_t scanned = 0;
+		start = clock_type::now();
+		for (typename btree<T>::const_iterator it = tree.cbegin(); it != missing; ++it) scanned++;
+		double scan_ns = ns_since(start, scanned);
+
+		std::cout << std::setw(10) << capacity << std::setw(12) << btree<T>::node_bytes_for(capacity)
+			<< std::setw(14) << std::fixed << std::setprecision(1) << insert_ns
+			<< std::setw(12) << find_ns << std::setw(14) << scan_ns
+			<< "   (" << found << " hits)" << std::endl;
+	}
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	std::string type = argc > 1 ? argv[1] : "int64";
+	std::size_t count = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000000;
+	std::vector<std::size_t> capacities;
+	for (int i = 3; i < argc; ++i) capacities.push_back(std::strtoul(argv[i], nullptr, 10));
+
+	if (type == "int32") sweep<std::int32_t>(count, capacities);
+	else if (type == "int64") sweep<std::int64_t>(count, capacities);
+	else if (type == "string") sweep<std::string>(count, capacities);
+	else if (type == "record64") sweep<record<64>>(count, capacities);
+	else if (type == "record256") sweep<record<256>>(count, capacities);
+	else {
+		std::cerr << "unknown type " << type << ", expected int32, int64, string, record64 or record256" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,176 @@
+/**
+ * Replays a trace written by a btree_recorder (see btree_trace.h)
+ * against a btree configured from the command line, timing every
+ * operation, and reports latency percentiles per operation type.  Run
+ * it once per configuration to compare them on the same traffic.
+ *
+ *   g++ -O2 -std=c++14 -I.. btree_replay.cpp -o btree_replay
+ *   ./btree_replay trace [option value]...
+ *
+ * Options:
+ *   --type int32|int64|string  the element type the trace was recorded with (int64)
+ *   --snapshot file            load() this snapshot before replaying
+ *   --capacity n               elements per node (the default for the type)
+ *   --buffer n                 set_insert_buffer(n), replaying inserts as insert_buffered()
+ *   --cache n                  set_lookup_cache(n)
+ *   --filter rate              set_filter(rate)
+ *   --walk n                   steps taken by each recorded walk (0, the default, walks to the end)
+ *   --paced 1                  keep the recorded gaps between operations instead of replaying flat out
+ *
+ * A trace logs where each walk started, from begin() or from rbegin(),
+ * but not how far it went, so every walk is replayed for the same
+ * number of steps, set by --walk.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/bench_util.h"
+#include "btree.h"
+
+namespace {
+
+struct options {
+	std::string trace;
+	std::string type = "int64";
+	std::string snapshot;
+	std::size_t capacity = 0;
+	std::size_t buffer = 0;
+	std::size_t cache = 0;
+	double filter = 0;
+	std::size_t walk = 0;
+	bool paced = false;
+};
+
+double percentile(const std::vector<double>& sorted, double fraction) {
+	std::size_t at = static_cast<std::size_t>(fraction * (sorted.size() - 1) + 0.5);
+	return sorted[at];
+}
+
+void report(std::vector<std::vector<double>>& latencies) {
+	std::cout << std::setw(16) << "operation" << std::setw(12) << "count" << std::setw(10) << "mean ns"
+		<< std::setw(10) << "p50" << std::setw(10) << "p90" << std::setw(10) << "p99" << std::setw(10) << "p99.9"
+		<< std::setw(12) << "max" << std::endl;
+	for (std::size_t op = 0; op < btree_op_count; ++op) {
+		std::vector<double>& took = latencies[op];
+		if (took.empty()) continue;
+		std::sort(took.begin(), took.end());
+		double total = 0;
+		for (double ns : took) total += ns;
+		std::cout << std::setw(16) << btree_op_name(static_cast<btree_op>(op)) << std::setw(12) << took.size()
+			<< std::fixed << std::setprecision(0) << std::setw(10) << total / took.size()
+			<< std::setw(10) << percentile(took, 0.5) << std::setw(10) << percentile(took, 0.9)
+			<< std::setw(10) << percentile(took, 0.99) << std::setw(10) << percentile(took, 0.999)
+			<< std::setw(12) << took.back() << std::endl;
+	}
+}
+
+template <typename T>
+int replay(const options& opts) {
+	btree<T> tree(opts.capacity != 0 ? opts.capacity : btree<T>().get_max_elem());
+	if (!opts.snapshot.empty()) {
+		std::ifstream in(opts.snapshot, std::ios::binary);
+		if (!tree.load(in)) {
+			std::cerr << "cannot load " << opts.snapshot << " as a snapshot of " << opts.type << std::endl;
+			return 1;
+		}
+	}
+	if (opts.buffer != 0) tree.set_insert_buffer(opts.buffer);
+	if (opts.cache != 0) tree.set_lookup_cache(opts.cache);
+	if (opts.filter != 0) tree.set_filter(opts.filter);
+
+	std::ifstream in(opts.trace, std::ios::binary);
+	btree_trace_reader<T> reader(in);
+	if (!reader.good()) {
+		std::cerr << "cannot read " << opts.trace << " as a trace of " << opts.type << std::endl;
+		return 1;
+	}
+	std::cout << "replaying " << opts.trace << " on " << tree.size() << " elements, capacity "
+		<< tree.get_max_elem() << std::endl;
+
+	std::vector<std::vector<double>> latencies(btree_op_count);
+	std::size_t hits = 0;
+	btree_trace_event<T> event;
+	clock_type::time_point origin = clock_type::now();
+	while (reader.next(event)) {
+		if (opts.paced) std::this_thread::sleep_until(origin + std::chrono::nanoseconds(event.time));
+		clock_type::time_point start = clock_type::now();
+		switch (event.op) {
+		case btree_op::insert:
+			if (opts.buffer != 0) tree.insert_buffered(event.elem);
+			else hits += tree.insert(event.elem).second;
+			break;
+		case btree_op::find:
+			hits += tree.find(event.elem) != tree.end();
+			break;
+		case btree_op::contains:
+			hits += tree.contains(event.elem);
+			break;
+		case btree_op::erase:
+			hits += tree.erase(event.elem);
+			break;
+		case btree_op::iterate: {
+			std::size_t steps = 0;
+			for (typename btree<T>::iterator it = tree.begin(); it != tree.end(); ++it) {
+				if (++steps == opts.walk) break;
+			}
+			hits += steps;
+			break;
+		}
+		case btree_op::reverse_iterate: {
+			std::size_t steps = 0;
+			for (typename btree<T>::reverse_iterator it = tree.rbegin(); it != tree.rend(); ++it) {
+				if (++steps == opts.walk) break;
+			}
+			hits += steps;
+			break;
+		}
+		}
+		latencies[static_cast<std::size_t>(event.op)].push_back(ns_since(start, 1));
+	}
+	report(latencies);
+	// keeps the lookups from being optimised away, and tells runs apart
+	std::cout << "(" << hits << " hits, " << tree.size() << " elements at the end)" << std::endl;
+	return 0;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2 || argc % 2 != 0) {
+		std::cerr << "usage: " << argv[0] << " trace [option value]..." << std::endl;
+		return 1;
+	}
+	options opts;
+	opts.trace = argv[1];
+	for (int i = 2; i + 1 < argc; i += 2) {
+		std::string name = argv[i];
+		const char* value = argv[i + 1];
+		if (name == "--type") opts.type = value;
+		else if (name == "--snapshot") opts.snapshot = value;
+		else if (name == "--capacity") opts.capacity = std::strtoul(value, nullptr, 10);
+		else if (name == "--buffer") opts.buffer = std::strtoul(value, nullptr, 10);
+		else if (name == "--cache") opts.cache = std::strtoul(value, nullptr, 10);
+		else if (name == "--filter") opts.filter = std::strtod(value, nullptr);
+		else if (name == "--walk") opts.walk = std::strtoul(value, nullptr, 10);
+		else if (name == "--paced") opts.paced = std::strtoul(value, nullptr, 10) != 0;
+		else {
+			std::cerr << "unknown option " << name << std::endl;
+			return 1;
+		}
+	}
+
+	if (opts.type == "int32") return replay<std::int32_t>(opts);
+	if (opts.type == "int64") return replay<std::int64_t>(opts);
+	if (opts.type == "string") return replay<std::string>(opts);
+	std::cerr << "unknown type " << opts.type << ", expected int32, int64 or string" << std::endl;
+	return 1;
+}